@@ -0,0 +1,73 @@
+#pragma once
+#include <cctype>
+#include <string>
+#include <limits>
+#include <vector>
+#include <stdexcept>
+#include "pkgs/minimist.hpp"
+#include "lib/cpx.hpp"
+
+class CpxArgs : public CpxOpts {
+public:
+    bool help = false;
+    bool version = false;
+    bool printStats = false;
+    std::vector<std::string> configs;
+    std::vector<std::string> parallelThresholds;
+    std::vector<std::string> orders;
+    std::vector<std::string> _;
+};
+
+constexpr ArgSpec<CpxArgs> CPX_ARGS[] = {
+    {.name = "clean", .letter = 'C', .flag = &CpxArgs::clean},
+    {.name = "command", .letter = 'c', .list = &CpxArgs::commands},
+    {.name = "compress", .list = &CpxArgs::compress},
+    {.name = "config", .list = &CpxArgs::configs},
+    {.name = "dereference", .letter = 'L', .flag = &CpxArgs::dereference},
+    {.name = "dry-run", .flag = &CpxArgs::dryRun},
+    {.name = "help", .letter = 'h', .flag = &CpxArgs::help},
+    {.name = "ignore-file", .list = &CpxArgs::ignoreFiles},
+    {.name = "include-empty-dirs", .alias = "includeEmptyDirs", .flag = &CpxArgs::includeEmptyDirs},
+    {.name = "initial", .flag = &CpxArgs::initial},
+    {.name = "io-uring", .flag = &CpxArgs::uring},
+    {.name = "order", .list = &CpxArgs::orders},
+    {.name = "parallel-threshold", .list = &CpxArgs::parallelThresholds},
+    {.name = "poll", .flag = &CpxArgs::poll},
+    {.name = "preserve", .letter = 'p', .flag = &CpxArgs::preserve},
+    {.name = "skip-identical", .flag = &CpxArgs::skipIdentical},
+    {.name = "stats", .flag = &CpxArgs::printStats},
+    {.name = "transform", .letter = 't', .list = &CpxArgs::transforms},
+    {.name = "update", .letter = 'u', .flag = &CpxArgs::update},
+    {.name = "verbose", .letter = 'v', .flag = &CpxArgs::verbose},
+    {.name = "version", .letter = 'V', .flag = &CpxArgs::version},
+    {.name = "watch", .letter = 'w', .flag = &CpxArgs::watch}
+};
+static_assert(validArgs(CPX_ARGS), "duplicate or malformed option in CPX_ARGS");
+
+// A byte count with an optional K, M or G suffix (powers of 1024)
+inline off_t parseSize(const std::string &s) {
+    size_t end = 0;
+    long long n = -1;
+    try {
+        n = std::stoll(s, &end);
+    } catch (const std::exception &) {
+    }
+    std::string unit = s.substr(std::min(end, s.size()));
+    size_t shift = std::string("KMG").find(unit.size() == 1 ? toupper(unit[0]) : '?');
+    if (n < 0 || (!unit.empty() && shift == std::string::npos)) throw std::runtime_error("Invalid size: " + s);
+    int bits = unit.empty() ? 0 : 10 * (shift + 1);
+    if (n > (std::numeric_limits<off_t>::max() >> bits)) throw std::runtime_error("Invalid size: " + s + " (too big)");
+    return (off_t)n << bits;
+}
+
+// Converts the options that are parsed as strings
+inline void finishArgs(CpxArgs &args) {
+    if (!args.parallelThresholds.empty()) args.parallelThreshold = parseSize(args.parallelThresholds.back());
+    if (!args.orders.empty()) {
+        const std::string &o = args.orders.back();
+        if (o == "walk") args.order = PlanOrder::Walk;
+        else if (o == "inode") args.order = PlanOrder::Inode;
+        else if (o == "extent") args.order = PlanOrder::Extent;
+        else throw std::runtime_error("Invalid order: " + o + " (walk, inode or extent)");
+    }
+}
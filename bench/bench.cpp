@@ -0,0 +1,304 @@
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <variant>
+#include <cstdlib>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <optional>
+#include <sys/stat.h>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+#include <nlohmann/json.hpp>
+#include "harness.hpp"
+#include "../args.hpp"
+#include "../lib/log.hpp"
+#include "../lib/copy.hpp"
+#include "../lib/compress.hpp"
+#include "../lib/paths.hpp"
+#include "../lib/uring.hpp"
+#include "../lib/manifest.hpp"
+#include "../pkgs/shellq.hpp"
+#include "../pkgs/minimist.hpp"
+#include "../pkgs/co/picomatch.hpp"
+
+/*
+ * Micro benchmarks for cpx, build with `make bench` and run ./cpx-bench [filter]. Results are printed and written to
+ * bench_output.txt, one tab separated line per case, so two runs can be diffed.
+ */
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace shq_regex {
+variant<json, vector<smatch>> parseShq(string s, env_t *env, optional<json> opts);
+}
+
+// what a build script typically runs
+const vector<const char *> CPX_ARGV = {"cpx", "src/**/*.{css,js,png}", "dist", "-w", "-v", "--no-initial", "-c",
+                                       "postcss --use autoprefixer", "--include-empty-dirs", "--update"};
+
+static string makeTree(size_t files, size_t size) {
+    char tmpl[] = "/tmp/cpx-bench-XXXXXX";
+    string root = mkdtemp(tmpl);
+    mkdir((root + "/src").c_str(), 0755);
+    mkdir((root + "/dst").c_str(), 0755);
+    string data(size, 'x');
+    for (size_t i = 0; i < files; i++) {
+        string p = root + "/src/f" + to_string(i) + ".css";
+        int fd = open(p.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (write(fd, data.data(), data.size()) < 0) perror(p.c_str());
+        close(fd);
+    }
+    return root;
+}
+
+static void benchArgs(Bench &b) {
+    vector<string> args(CPX_ARGV.begin() + 1, CPX_ARGV.end());
+    b.run("args/minimist-json", [&args]() {
+        // built on every run, like index.cpp used to at startup
+        MinimistOpts m;
+        m.alias = {{"c", "command"}, {"C", "clean"}, {"h", "help"}, {"includeEmptyDirs", "include-empty-dirs"},
+                   {"L", "dereference"}, {"p", "preserve"}, {"t", "transform"}, {"u", "update"}, {"v", "verbose"},
+                   {"V", "version"}, {"w", "watch"}};
+        m.boolean = vector<string>{"clean", "dereference", "help", "include-empty-dirs", "initial", "io-uring",
+                                   "preserve", "skip-identical", "update", "verbose", "version", "watch"};
+        m.string = vector<string>{"command", "transform"};
+        m.def = {{"initial", true}};
+        json r = minimist(args, m);
+    });
+    b.run("args/typed", []() {
+        vector<string_view> unknown;
+        CpxArgs r = parseArgs(CPX_ARGS, CPX_ARGV.size(), CPX_ARGV.data(), unknown);
+    });
+}
+
+static void benchShellq(Bench &b) {
+    string shortLine = "postcss --use autoprefixer -o \"$FILE.min\"";
+    string longLine = "postcss --use autoprefixer";
+    for (size_t i = 0; longLine.size() < 2048; i++) {
+        longLine += i % 4 == 0 ? " \"$FILE.min\"" : i % 4 == 1 ? " --opt='a b'" : i % 4 == 2 ? " | gzip -c" : " src/**/*.css";
+    }
+    function<string(string)> vars = [](const string &key) { return string(key == "FILE" ? "src/a.css" : ""); };
+    env_t env = vars;
+    for (auto &[name, line] : {pair<string, string &>{"short", shortLine}, {"long", longLine}}) {
+        if (get<json>(parseShq(line, &env, nullopt)) != get<json>(shq_regex::parseShq(line, &env, nullopt))) {
+            printf("shellq/%s: regex and scanner outputs differ!\n", name.c_str());
+        }
+        b.run("shellq/" + name + "/regex", [&]() { shq_regex::parseShq(line, &env, nullopt); });
+        b.run("shellq/" + name + "/json", [&]() { parseShq(line, &env, nullopt); });
+        b.run("shellq/" + name + "/tokens", [&]() { parseShqTokens(line, &env); });
+    }
+}
+
+static void benchGlob(Bench &b) {
+    const char *dirs[] = {"src", "src/components", "src/components/button", "assets/img", "node_modules/x/dist", ".cache"};
+    const char *exts[] = {".css", ".js", ".min.js", ".png", ".ts", ".map"};
+    vector<string> paths;
+    for (size_t i = 0; i < 10000; i++) {
+        paths.push_back(string(dirs[i % 6]) + "/file" + to_string(i) + exts[(i / 6) % 6]);
+    }
+    vector<string_view> views(paths.begin(), paths.end());
+    BenchOpts perPath;
+    perPath.opsPerCall = paths.size();
+    for (const char *glob : {"src/**/*.{css,js}", "**/*.min.js", "src/*/button/*.?s", "assets/img/**"}) {
+        Picomatch pm(glob);
+        size_t hits = 0;
+        b.run(string("glob/match/") + glob, [&]() {
+            for (string_view p : views) {
+                hits += pm.match(p);
+            }
+        }, perPath);
+    }
+    Picomatch pm("src/**/*.{css,js}");
+    vector<uint32_t> hits;
+    b.run("glob/matchMany/src/**/*.{css,js}", [&]() {
+        hits.clear();
+        pm.matchMany(views, hits);
+    }, perPath);
+    b.run("glob/compile", []() { Picomatch p("src/**/*.{css,scss,js}"); });
+
+    vector<string> globs = {"**/*.{css,js}", "!**/node_modules/**", "!**/*.min.js"};
+    PicomatchSet set(globs);
+    set.addIgnore("# build output\n/.cache/\n*.map\n!keep.map\n");
+    size_t hits2 = 0;
+    b.run("glob/set/match", [&]() {
+        for (string_view p : views) {
+            hits2 += set.match(p);
+        }
+    }, perPath);
+    BenchOpts perDir;
+    perDir.opsPerCall = 6;
+    b.run("glob/set/couldMatchBelow", [&]() {
+        for (const char *d : dirs) {
+            hits2 += set.couldMatchBelow(d);
+        }
+    }, perDir);
+}
+
+static void benchCopy(Bench &b, size_t size) {
+    const size_t files = 1000;
+    string root = makeTree(files, size);
+    vector<UringJob> jobs;
+    for (size_t i = 0; i < files; i++) {
+        string name = "/f" + to_string(i) + ".css";
+        jobs.push_back(UringJob{root + "/src" + name, root + "/dst" + name, (off_t)size, 0644});
+    }
+    string suffix = "/" + to_string(size / 1024) + "KB";
+
+    CopyEngine engine;
+    CopyOpts opts;
+    // creating files is much slower than rewriting them, every case below rewrites existing destinations
+    for (UringJob &j : jobs) {
+        engine.copy(j.src, j.dst, opts);
+    }
+    size_t next = 0;
+    b.run("copy/file" + suffix, [&]() {
+        UringJob &j = jobs[next++ % files];
+        engine.copy(j.src, j.dst, opts);
+    });
+
+    UringCopier ring;
+    if (ring.available()) {
+        vector<UringJob> batch(jobs.begin(), jobs.begin() + 256);
+        BenchOpts perFile;
+        perFile.opsPerCall = batch.size();
+        b.run("copy/io_uring" + suffix, [&]() { ring.copy(batch, [](const UringJob &, int) {}); }, perFile);
+    }
+    if (system(("rm -rf " + root).c_str()) != 0) perror("rm");
+}
+
+// node_modules like: 400 files per package in 20 directories, a few names in every directory and module names shared
+// between packages
+static const string &syntheticPath(size_t i, string &out) {
+    static const char *common[] = {"index.js", "index.d.ts", "package.json", "README.md"};
+    static const char *dirs[] = {"lib", "dist", "src", "test", "types"};
+    out = "node_modules/pkg" + to_string(i / 400) + "/" + dirs[i / 20 % 5] + "/m" + to_string(i / 100 % 4) + "/";
+    if (i % 20 < 4) out += common[i % 20];
+    else out += "module" + to_string(i % 1000) + ".js";
+    return out;
+}
+
+// Interns `n` paths into what `add` builds and reports the heap it still holds per path
+static void benchMemory(Bench &b, const string &name, size_t n, const function<void(const string &)> &add) {
+    size_t bytes = benchBytes.load(memory_order_relaxed);
+    size_t allocs = benchAllocs.load(memory_order_relaxed);
+    chrono::steady_clock::time_point t = chrono::steady_clock::now();
+    string path;
+    for (size_t i = 0; i < n; i++) {
+        add(syntheticPath(i, path));
+    }
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - t).count();
+    bytes = benchBytes.load(memory_order_relaxed) - bytes;
+    allocs = benchAllocs.load(memory_order_relaxed) - allocs;
+    b.add(BenchResult{name, n, ns / n, (double)allocs / n, 0, 0, 0, (double)bytes / n});
+}
+
+static void benchPaths(Bench &b) {
+    for (size_t n : {1000000, 10000000}) {
+        string suffix = "/" + to_string(n / 1000000) + "M";
+        if (b.wants("paths/store" + suffix)) {
+            PathStore store;
+            benchMemory(b, "paths/store" + suffix, n, [&store](const string &p) { store.intern(p); });
+        }
+        // what the manifest collects for the next run: ids into the store and one entry per id
+        if (b.wants("paths/manifest" + suffix)) {
+            PathStore store;
+            vector<ManifestEntry> next;
+            benchMemory(b, "paths/manifest" + suffix, n, [&](const string &p) {
+                uint32_t id = store.intern(p);
+                if (id >= next.size()) next.resize(id + 1);
+                next[id] = ManifestEntry{1, 0, 0, 0, 1};
+            });
+        }
+        // the map of full path strings it used before, 10M of them take more memory than a build machine may have
+        if (n == 1000000 && b.wants("paths/map" + suffix)) {
+            unordered_map<string, ManifestEntry> next;
+            benchMemory(b, "paths/map" + suffix, n, [&next](const string &p) { next[p] = ManifestEntry{1, 0, 0, 0, 0}; });
+        }
+    }
+    PathStore store;
+    vector<uint32_t> ids;
+    string path;
+    for (size_t i = 0; i < 100000; i++) {
+        ids.push_back(store.intern(syntheticPath(i, path)));
+    }
+    size_t next = 0;
+    b.run("paths/find", [&]() { store.find(syntheticPath(next++ % ids.size(), path)); });
+    b.run("paths/path", [&]() { store.path(ids[next++ % ids.size()], path); });
+}
+
+// One verbose line per copied file, to /dev/null so only the cost on the copying thread is measured
+static void benchLog(Bench &b) {
+    string line = "Copied: src/components/button/index.css --> dist/components/button/index.css";
+    ofstream null("/dev/null");
+    mutex mtx;
+    b.run("log/stdio", [&]() {
+        // what Cpx::log did: a shared lock and a flush per line
+        lock_guard<mutex> lock(mtx);
+        null << line << endl;
+    });
+    int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    {
+        Logger l(64 * 1024, fd, fd);
+        b.run("log/ring", [&]() { l.write(LogStream::Out, line, true); });
+        printf("log/ring: %llu line(s) dropped\n", (unsigned long long)l.dropped());
+    }
+    close(fd);
+}
+
+// Precompressing 100 files of 16KB of script text, and going over them again once the siblings are fresh
+static void benchCompress(Bench &b) {
+    const size_t files = 100;
+    string root = makeTree(0, 0);
+    string text;
+    for (size_t i = 0; text.size() < 16 * 1024; i++) {
+        text += "export function handler" + to_string(i) + "(event) { return event.target.value * " + to_string(i % 7) + "; }\n";
+    }
+    vector<string> paths;
+    for (size_t i = 0; i < files; i++) {
+        paths.push_back(root + "/src/f" + to_string(i) + ".js");
+        int fd = open(paths.back().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (write(fd, text.data(), text.size()) < 0) perror(paths.back().c_str());
+        close(fd);
+    }
+    BenchOpts perFile;
+    perFile.opsPerCall = files;
+    for (const char *format : {"gz", "br", "zst", "gz,br,zst"}) {
+        CompressOpts co;
+        co.formats = parseCompress({format});
+        Compressor c(co);
+        b.run(string("compress/") + format, [&]() {
+            for (const string &p : paths) {
+                c.remove(p);
+                c.submit(p, p, p);
+            }
+            c.wait();
+        }, perFile);
+        b.run(string("compress/") + format + "/fresh", [&]() {
+            for (const string &p : paths) {
+                c.submit(p, p, p);
+            }
+            c.wait();
+        }, perFile);
+    }
+    if (system(("rm -rf " + root).c_str()) != 0) perror("rm");
+}
+
+int main(int argc, char **argv) {
+    Bench b(argc > 1 ? argv[1] : "");
+    benchArgs(b);
+    benchShellq(b);
+    benchGlob(b);
+    benchPaths(b);
+    benchLog(b);
+    benchCompress(b);
+    benchCopy(b, 2 * 1024);
+    benchCopy(b, 32 * 1024);
+    b.write("bench_output.txt");
+    return 0;
+}
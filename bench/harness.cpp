@@ -0,0 +1,98 @@
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <malloc.h>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include "harness.hpp"
+
+using namespace std;
+using bclock = chrono::steady_clock;
+
+atomic<size_t> benchAllocs{0};
+atomic<size_t> benchBytes{0};
+
+void *operator new(size_t size) {
+    benchAllocs.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(size == 0 ? 1 : size)) {
+        benchBytes.fetch_add(malloc_usable_size(p), memory_order_relaxed);
+        return p;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    if (p != nullptr) benchBytes.fetch_sub(malloc_usable_size(p), memory_order_relaxed);
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    operator delete(p);
+}
+
+const double BATCH_NS = 20000;
+const size_t MAX_SAMPLES = 20000;
+
+static double percentile(const vector<double> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    return sorted[min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+void Bench::run(const string &name, const function<void()> &fn, optional<BenchOpts> _opts) {
+    if (!wants(name)) return;
+    BenchOpts opts = _opts.value_or(BenchOpts());
+    bclock::time_point t = bclock::now();
+    fn();
+    double first = chrono::duration<double, nano>(bclock::now() - t).count();
+    size_t batch = max<size_t>(1, min<size_t>(1000000, BATCH_NS / max(first, 1.0)));
+
+    vector<double> samples;
+    size_t calls = 0;
+    double total = 0;
+    size_t allocs = benchAllocs.load(memory_order_relaxed);
+    while (total < opts.seconds * 1e9 && samples.size() < MAX_SAMPLES) {
+        t = bclock::now();
+        for (size_t i = 0; i < batch; i++) {
+            fn();
+        }
+        double ns = chrono::duration<double, nano>(bclock::now() - t).count();
+        total += ns;
+        calls += batch;
+        samples.push_back(ns / (batch * opts.opsPerCall));
+    }
+    allocs = benchAllocs.load(memory_order_relaxed) - allocs;
+    sort(samples.begin(), samples.end());
+
+    size_t ops = calls * opts.opsPerCall;
+    add(BenchResult{name, ops, total / ops, (double)allocs / ops, percentile(samples, 0.5), percentile(samples, 0.9),
+                    percentile(samples, 0.99)});
+}
+
+void Bench::add(const BenchResult &r) {
+    if (!wants(r.name)) return;
+    if (r.bytesPerOp > 0) {
+        printf("%-36s %12.1f ns/op %9.2f allocs/op  %.1f bytes/op\n", r.name.c_str(), r.nsPerOp, r.allocsPerOp,
+               r.bytesPerOp);
+    } else {
+        printf("%-36s %12.1f ns/op %9.2f allocs/op  p50 %.1f  p90 %.1f  p99 %.1f\n", r.name.c_str(), r.nsPerOp,
+               r.allocsPerOp, r.p50, r.p90, r.p99);
+    }
+    fflush(stdout);
+    _results.push_back(r);
+}
+
+void Bench::write(const string &file) const {
+    FILE *f = fopen(file.c_str(), "w");
+    if (f == nullptr) throw runtime_error("Cannot write " + file);
+    fprintf(f, "name\tns_per_op\tallocs_per_op\tp50_ns\tp90_ns\tp99_ns\tbytes_per_op\n");
+    for (const BenchResult &r : _results) {
+        fprintf(f, "%s\t%.1f\t%.2f\t%.1f\t%.1f\t%.1f\t%.1f\n", r.name.c_str(), r.nsPerOp, r.allocsPerOp, r.p50, r.p90,
+                r.p99, r.bytesPerOp);
+    }
+    fclose(f);
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <optional>
+#include <functional>
+
+// Number of operator new calls so far, counted by the replacement in harness.cpp
+extern std::atomic<size_t> benchAllocs;
+// Heap bytes allocated with operator new and not deleted yet, as malloc sizes them
+extern std::atomic<size_t> benchBytes;
+
+class BenchOpts {
+public:
+    // Wall time spent measuring one case
+    double seconds = 0.3;
+    // Operations done by one call of the benchmarked function, results are reported per operation
+    size_t opsPerCall = 1;
+};
+
+class BenchResult {
+public:
+    std::string name;
+    size_t ops;
+    double nsPerOp;
+    double allocsPerOp;
+    double p50;
+    double p90;
+    double p99;
+    // Heap bytes kept per entry, only set by memory cases
+    double bytesPerOp = 0;
+};
+
+/*
+ * Runs each case in batches of roughly 20us, the percentiles are over the per operation time of those batches. Only
+ * cases whose name contains `filter` run.
+ */
+class Bench {
+public:
+    explicit Bench(std::string filter = "") : _filter(filter) {}
+
+    void run(const std::string &name, const std::function<void()> &fn, std::optional<BenchOpts> opts = std::nullopt);
+    // For cases measured by the caller, like the memory held by a structure with a given number of entries
+    bool wants(const std::string &name) const { return name.find(_filter) != std::string::npos; }
+    void add(const BenchResult &r);
+    // Tab separated, one line per case, in the order they ran
+    void write(const std::string &file) const;
+
+private:
+    std::string _filter;
+    std::vector<BenchResult> _results;
+};
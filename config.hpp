@@ -0,0 +1,80 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <nlohmann/json.hpp>
+#include "args.hpp"
+
+class CpxJob {
+public:
+    std::vector<std::string> sources;
+    std::string dest;
+    CpxOpts opts;
+};
+
+/*
+ * Reads the jobs of `--config <file>`: an array of objects (or {"jobs": [...]}) with "source" (a glob or an array of
+ * them), "dest" and any long option of the command line, like "watch": true or "command": ["..."].
+ * Options given on the command line are the defaults of every job.
+ */
+inline std::vector<CpxJob> loadConfig(const std::string &file, const CpxOpts &defaults) {
+    std::ifstream in(file);
+    if (!in) throw std::runtime_error("Cannot read " + file);
+    nlohmann::json doc;
+    try {
+        doc = nlohmann::json::parse(in);
+    } catch (const nlohmann::json::exception &e) {
+        throw std::runtime_error("Cannot parse " + file + ": " + e.what());
+    }
+    if (doc.is_object() && doc.contains("jobs")) doc = doc["jobs"];
+    if (!doc.is_array()) throw std::runtime_error(file + ": expected an array of jobs");
+
+    std::vector<CpxJob> jobs;
+    for (const nlohmann::json &j : doc) {
+        std::string where = file + ": job " + std::to_string(jobs.size() + 1);
+        if (!j.is_object()) throw std::runtime_error(where + " is not an object");
+        CpxArgs args;
+        static_cast<CpxOpts &>(args) = defaults;
+        CpxJob job;
+        for (auto &[key, value] : j.items()) {
+            if (key == "source" && value.is_array()) {
+                for (const nlohmann::json &v : value) {
+                    if (!v.is_string()) throw std::runtime_error(where + ": \"source\" must be strings");
+                    job.sources.push_back(v.get<std::string>());
+                }
+                continue;
+            }
+            if (key == "source" || key == "dest") {
+                if (!value.is_string()) throw std::runtime_error(where + ": \"" + key + "\" must be a string");
+                if (key == "source") job.sources.push_back(value.get<std::string>());
+                else job.dest = value.get<std::string>();
+                continue;
+            }
+            const ArgSpec<CpxArgs> *spec = nullptr;
+            for (const ArgSpec<CpxArgs> &s : CPX_ARGS) {
+                if (s.name == key || (!s.alias.empty() && s.alias == key)) spec = &s;
+            }
+            if (spec == nullptr || spec->flag == &CpxArgs::help || spec->flag == &CpxArgs::version
+                || spec->flag == &CpxArgs::printStats || spec->list == &CpxArgs::configs) {
+                throw std::runtime_error(where + ": unknown option \"" + key + "\"");
+            }
+            if (spec->flag != nullptr) {
+                if (!value.is_boolean()) throw std::runtime_error(where + ": \"" + key + "\" must be a boolean");
+                args.*(spec->flag) = value.get<bool>();
+                continue;
+            }
+            std::vector<std::string> &list = args.*(spec->list);
+            list.clear();
+            for (const nlohmann::json &v : value.is_array() ? value : nlohmann::json::array({value})) {
+                if (!v.is_string()) throw std::runtime_error(where + ": \"" + key + "\" must be strings");
+                list.push_back(v.get<std::string>());
+            }
+        }
+        if (job.sources.empty() || job.dest.empty()) throw std::runtime_error(where + " needs \"source\" and \"dest\"");
+        finishArgs(args);
+        job.opts = args;
+        jobs.push_back(std::move(job));
+    }
+    return jobs;
+}
@@ -4,24 +4,57 @@
 
 using namespace std;
 
-const string helptxt = "Usage: cpx <source> <dest> [options]\n\n"
+const string helptxt = "Usage: cpx <source>... <dest> [options]\n"
+"       cpx --config <jobs.json> [options]\n\n"
 "    Copy files, watching for changes.\n\n"
-"        <source>  The glob of target files.\n"
+"        <source>  The glob of target files. Several can be given, the ones\n"
+"                  starting with '!' exclude what they match.\n"
 "        <dest>    The path of a destination directory.\n\n"
 "Options:\n"
 "    -c, --command <command>   A command text to transform each file.\n"
+"    --compress <formats>      Also write precompressed siblings (file.js.gz, ...)\n"
+"                              of text-like web assets for the web server, in\n"
+"                              'gz', 'br' and/or 'zst', like 'gz,br' or 'br:9'\n"
+"                              for a level. Siblings that are not older than\n"
+"                              their source are kept.\n"
+"    --config <file>           Run every job of a JSON file in one process: an\n"
+"                              array of {\"source\", \"dest\", <option>: value}.\n"
+"                              Other options are the defaults of each job.\n"
 "    -C, --clean               Clean files that matches <source> like pattern in\n"
 "                              <dest> directory before the first copying.\n"
 "    -L, --dereference         Follow symbolic links when copying from them.\n"
+"    --dry-run                 Print the directories, copies and links of the\n"
+"                              initial copy (and the files --clean removes)\n"
+"                              without doing them.\n"
 "    -h, --help                Print usage information.\n"
+"    --ignore-file <file>      A .gitignore style file of paths not to copy, its\n"
+"                              patterns are relative to its directory.\n"
 "    --include-empty-dirs      The flag to copy empty directories which is\n"
 "                              matched with the glob.\n"
+"    --io-uring                The flag to copy small files in batches through\n"
+"                              io_uring when the kernel supports it.\n"
 "    --no-initial              The flag to not copy at the initial time of watch.\n"
 "                              Use together '--watch' option.\n"
+"    --order <order>           Plan the initial copy and run it sorted by source\n"
+"                              'inode' or 'extent' (position on disk), so\n"
+"                              spinning disks read sequentially. The default\n"
+"                              'walk' copies while scanning.\n"
+"    --parallel-threshold <size>\n"
+"                              Copy files of at least this size (like 512M) in\n"
+"                              ranges on several threads, 0 for never. The\n"
+"                              default is 64M.\n"
+"    --poll                    Watch by polling with statx instead of inotify.\n"
+"                              This is automatic for sources on NFS, SMB, FUSE\n"
+"                              and overlay filesystems.\n"
 "    -p, --preserve            The flag to copy attributes of files.\n"
 "                              This attributes are uid, gid, atime, and mtime.\n"
-"    -t, --transform <name>    A module name to transform each file. cpx lookups\n"
-"                                the specified name via \"require()\".\n"
+"    --skip-identical          The flag to not write files whose content is\n"
+"                              already the same on destination.\n"
+"    --stats                   Print counters, phase timings and latency\n"
+"                              histograms as JSON to stderr on exit, and on\n"
+"                              SIGUSR1 while watching.\n"
+"    -t, --transform <file>    A shared object to transform each file with, see\n"
+"                              lib/cpx_plugin.h. cpx loads it with dlopen().\n"
 "    -u, --update              The flag to not overwrite files on destination if\n"
 "                              the source file is older.\n"
 "    -v, --verbose             Print copied/removed files.\n"
@@ -30,7 +63,9 @@ const string helptxt = "Usage: cpx <source> <dest> [options]\n\n"
 "                              the file to <dest> every changing.\n\n"
 "Examples:\n\n"
 "    cpx \"src/**/*.{html,png,jpg}\" app\n"
-"    cpx \"src/**/*.css\" app --watch --verbose\n\n"
+"    cpx \"src/**/*.css\" app --watch --verbose\n"
+"    cpx \"src/**/*.{html,css,js}\" app --compress gz,br\n"
+"    cpx \"**/*.js\" \"!**/node_modules/**\" app --ignore-file .gitignore\n\n"
 "See Also:\n"
 "    https://github.com/mysticatea/cpx\n";
 
@@ -1,96 +1,105 @@
 #include <set>
+#include <memory>
+#include <string>
+#include <vector>
 #include <iostream>
-#include <optional>
-#include <variant>
-#include <type_traits>
-#include <nlohmann/json.hpp>
+#include <string_view>
+#include "args.hpp"
 #include "help.hpp"
-#include "pkgs/shellq.hpp"
-#include "pkgs/minimist.hpp"
+#include "config.hpp"
+#include "lib/log.hpp"
 
 using namespace std;
-using json = nlohmann::json;
 
 int main(int argc, char **argv) {
-    vector<string> _args;
-    for (int i = 0; i < argc; i++) {
-        if (i < 1) continue;
-        _args.push_back(string(argv[i]));
+    PhaseTimer parsing(Phase::Args);
+    vector<string_view> unknown;
+    CpxArgs args = parseArgs(CPX_ARGS, argc, argv, unknown);
+    set<string_view> unknowns(unknown.begin(), unknown.end());
+    stats.enabled = args.printStats;
+    string invalid;
+    try {
+        finishArgs(args);
+    } catch (const exception &e) {
+        invalid = e.what();
     }
-
-    set<string> unknowns;
-    MinimistOpts m;
-    m.alias = {
-        {"c", "command"},
-        {"C", "clean"},
-        {"h", "help"},
-        {"includeEmptyDirs", "include-empty-dirs"},
-        {"L", "dereference"},
-        {"p", "preserve"},
-        {"t", "transform"},
-        {"u", "update"},
-        {"v", "verbose"},
-        {"V", "version"},
-        {"w", "watch"}
-    };
-    m.boolean = vector<string>{
-        "clean",
-        "dereference",
-        "help",
-        "include-empty-dirs",
-        "initial",
-        "preserve",
-        "update",
-        "verbose",
-        "version",
-        "watch"
-    };
-    m.def = {
-        {"initial", true}
-    };
-    function<bool(string)> unknownFn = [&unknowns](string arg) {
-        if (arg.size() < 1) return false;
-        if (arg[0] == '-') unknowns.insert(arg);
-        return true;
-    };
-    m.unknown = &unknownFn;
-    json args = minimist(_args, m);
+    parsing.stop();
 
     int code = 0;
     bool _sh = false;
 
-    if (!args.contains("_") || !args["_"].is_array() || args["_"].size() < 2) _sh = true;
-    string source = _sh ? "" : args["_"][0];
-    string dest = _sh ? "" : args["_"][1];
+    if (args._.size() < 2) _sh = true;
+    // every positional but the last is a source glob
+    vector<string> sources = _sh ? vector<string>() : vector<string>(args._.begin(), args._.end() - 1);
+    string dest = _sh ? "" : args._.back();
 
     if (unknowns.size() > 0) {
         cerr << "Unknown option(s): ";
         size_t i = 0;
-        for (string o : unknowns) {
+        for (string_view o : unknowns) {
             cerr << o;
             if (i < unknowns.size() - 1) cerr << ", ";
             else cerr << endl;
             i++;
         }
         code = 1;
-    } else if (args.contains("help") && args["help"] == true) {
+    } else if (!invalid.empty()) {
+        cerr << invalid << endl;
+        code = 1;
+    } else if (args.help) {
         help();
-    } else if (args.contains("version") && args["version"]) {
+    } else if (args.version) {
         cout << "1.0.0" << endl;
-    } else if (source.size() < 1 || dest.size() < 1 || _sh) {
+    } else if (!args.configs.empty()) {
+        try {
+            vector<CpxJob> jobs;
+            for (const string &file : args.configs) {
+                vector<CpxJob> more = loadConfig(file, args);
+                jobs.insert(jobs.end(), more.begin(), more.end());
+            }
+            // a watch waits for the signals with sigwait, no thread may take them before
+            for (const CpxJob &job : jobs) {
+                if (job.opts.watch && !job.opts.dryRun) {
+                    Cpx::blockSignals();
+                    break;
+                }
+            }
+            vector<unique_ptr<Cpx>> all;
+            vector<Cpx *> watched;
+            for (const CpxJob &job : jobs) {
+                all.push_back(make_unique<Cpx>(job.sources, job.dest, job.opts));
+                if (!job.opts.watch || job.opts.initial) {
+                    if (all.back()->copy() > 0) code = 1;
+                }
+                if (job.opts.watch && !job.opts.dryRun) watched.push_back(all.back().get());
+            }
+            if (!watched.empty()) Cpx::watch(watched);
+        } catch (const exception &e) {
+            logger.write(LogStream::Err, e.what());
+            code = 1;
+        }
+    } else if (_sh || sources[0].empty() || dest.empty()) {
         help();
         cerr <<  "Missing either source or dest options" << endl;
         code = 1;
     } else {
-        initToken();
-        json env = {
-            {"PWD", "/home/robot"}
-        };
-        env_t _env = env;
-        auto res = parseShq("a \"b c\" \\$def 'it\\'s great'", &_env, nullopt);
-        json j = *get_if<json>(&res);
-        cout << j.dump() << endl;
+        const CpxOpts &opts = args;
+        try {
+            if (opts.watch && !opts.dryRun) Cpx::blockSignals();
+            Cpx cpx(sources, dest, opts);
+            if (!opts.watch || opts.initial) {
+                if (cpx.copy() > 0) code = 1;
+            }
+            // a dry run only shows the initial copy
+            if (opts.watch && !opts.dryRun) cpx.watch();
+        } catch (const exception &e) {
+            logger.write(LogStream::Err, e.what());
+            code = 1;
+        }
     }
 
+    // the last lines of the workers go out before the stats
+    logger.close();
+    if (stats.enabled) cerr << stats.toJson() << endl;
     return code;
 }
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include <mutex>
+#include <cerrno>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <functional>
+#include <sys/syscall.h>
+#include "clean.hpp"
+#include "stats.hpp"
+
+using namespace std;
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+Cleaner::Cleaner(const string &root, CleanOpts opts) : _opts(opts) {
+    if (_opts.glob == nullptr) throw runtime_error("Cleaner needs a glob");
+    _rootFd = open(root.empty() ? "." : root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (_rootFd < 0) {
+        // nothing to clean in a destination that doesn't exist yet
+        if (errno != ENOENT) throw runtime_error("Cannot clean " + root + ": " + strerror(errno));
+        _finished = true;
+        return;
+    }
+    auto it = _nodes.emplace("", Node{nullptr, nullptr, 1, false, false, false, false, false}).first;
+    it->second.path = &it->first;
+    _queue.push_back(&it->second);
+    unsigned n = _opts.threads > 0 ? _opts.threads : max(1u, thread::hardware_concurrency());
+    for (unsigned i = 0; i < n; i++) {
+        _threads.emplace_back(&Cleaner::work, this);
+    }
+}
+
+Cleaner::~Cleaner() {
+    wait();
+    if (_rootFd >= 0) close(_rootFd);
+}
+
+size_t Cleaner::wait() {
+    for (thread &t : _threads) {
+        t.join();
+    }
+    _threads.clear();
+    return _removed;
+}
+
+void Cleaner::claim(string_view dir) {
+    if (_finished.load(memory_order_acquire)) return;
+    unique_lock<mutex> lock(_mtx);
+    Node *n = &_nodes.at("");
+    size_t pos = 0;
+    for (;;) {
+        // claimed directories are never removed, so the writer can't lose the directory it just created
+        n->claimed = true;
+        _state.wait(lock, [n]() { return n->scanned; });
+        if (n->removed || pos >= dir.size()) return;
+        size_t slash = dir.find('/', pos);
+        if (slash == string_view::npos) slash = dir.size();
+        auto it = _nodes.find(string(dir.substr(0, slash)));
+        // not in the destination, or nothing in it can match: there is nothing to wait for below `n`
+        if (it == _nodes.end()) return;
+        n = &it->second;
+        pos = slash + 1;
+    }
+}
+
+void Cleaner::work() {
+    for (;;) {
+        Node *n;
+        {
+            unique_lock<mutex> lock(_mtx);
+            _work.wait(lock, [this]() { return !_queue.empty() || _finished; });
+            if (_queue.empty()) return;
+            n = _queue.front();
+            _queue.pop_front();
+        }
+        scan(n);
+    }
+}
+
+void Cleaner::scan(Node *n) {
+    const string &rel = *n->path;
+    int fd = rel.empty() ? dup(_rootFd) : openat(_rootFd, rel.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    stats.sys(Sys::Open);
+    if (fd >= 0) stats.add(Counter::DirsScanned);
+    if (fd < 0 && errno != ENOENT && _opts.onError != nullptr) (*_opts.onError)(rel, errno);
+
+    thread_local vector<char> buf(32 * 1024);
+    thread_local string path;
+    thread_local vector<pair<string, bool>> subdirs;
+    subdirs.clear();
+    path = _opts.prefix + rel;
+    if (!rel.empty()) path += '/';
+    size_t plen = path.size();
+    size_t rlen = _opts.prefix.size();
+    bool removedAny = false;
+    while (fd >= 0) {
+        long len = syscall(SYS_getdents64, fd, buf.data(), buf.size());
+        stats.sys(Sys::Getdents);
+        if (len <= 0) break;
+        for (long off = 0; off < len;) {
+            linux_dirent64 *d = (linux_dirent64 *)(buf.data() + off);
+            off += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) continue;
+            unsigned char type = d->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+            }
+            path.resize(plen);
+            path += name;
+            if (type == DT_DIR) {
+                if (_opts.glob->couldMatchBelow(path)) subdirs.emplace_back(path.substr(rlen), _opts.glob->match(path));
+                continue;
+            }
+            // symlinks are removed themselves, never followed
+            bool matched = _opts.glob->match(path);
+            for (size_t i = 0; !matched && i < _opts.siblings.size(); i++) {
+                const string &s = _opts.siblings[i];
+                if (path.size() > s.size() + plen && path.compare(path.size() - s.size(), s.size(), s) == 0) {
+                    matched = _opts.glob->match(string_view(path).substr(0, path.size() - s.size()));
+                }
+            }
+            if (!matched) continue;
+            if (_opts.dryRun) {
+                if (_opts.onRemove != nullptr) (*_opts.onRemove)(string_view(path).substr(rlen), false);
+                continue;
+            }
+            stats.sys(Sys::Unlink);
+            if (unlinkat(fd, name, 0) != 0) {
+                if (errno != ENOENT && _opts.onError != nullptr) (*_opts.onError)(string_view(path).substr(rlen), errno);
+                continue;
+            }
+            removedAny = true;
+            _removed++;
+            stats.add(Counter::FilesRemoved);
+            if (_opts.onRemove != nullptr) (*_opts.onRemove)(string_view(path).substr(rlen), false);
+        }
+    }
+    if (fd >= 0) close(fd);
+
+    lock_guard<mutex> lock(_mtx);
+    for (auto &[sub, matched] : subdirs) {
+        auto it = _nodes.emplace(sub, Node{nullptr, n, 1, matched, false, false, false, false}).first;
+        it->second.path = &it->first;
+        n->pending++;
+        _queue.push_back(&it->second);
+    }
+    n->removedAny = n->removedAny || removedAny;
+    n->scanned = true;
+    if (!subdirs.empty()) _work.notify_all();
+    _state.notify_all();
+    finish(n);
+}
+
+// Called with the lock held once `n` is scanned, directories whose subtree is done go bottom-up
+void Cleaner::finish(Node *n) {
+    while (n != nullptr && --n->pending == 0) {
+        Node *parent = n->parent;
+        if (parent != nullptr && !n->claimed && !_opts.dryRun && (n->removedAny || n->matched)) {
+            stats.sys(Sys::Unlink);
+            if (unlinkat(_rootFd, n->path->c_str(), AT_REMOVEDIR) == 0) {
+                n->removed = true;
+                parent->removedAny = true;
+                if (_opts.onRemove != nullptr) (*_opts.onRemove)(*n->path, true);
+            } else if (errno != ENOTEMPTY && errno != EEXIST && errno != ENOENT && _opts.onError != nullptr) {
+                (*_opts.onError)(*n->path, errno);
+            }
+        }
+        if (parent == nullptr) {
+            _finished = true;
+            _work.notify_all();
+            _state.notify_all();
+        }
+        n = parent;
+    }
+}
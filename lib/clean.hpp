@@ -0,0 +1,73 @@
+#pragma once
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+#include <condition_variable>
+#include "../pkgs/co/picomatch.hpp"
+
+class CleanOpts {
+public:
+    unsigned threads = 0;
+    // Files are removed when `prefix` (empty or ending in a slash) + their path relative to the root matches
+    const PicomatchSet *glob = nullptr;
+    std::string prefix;
+    // Suffixes of files that go with another one, like compressed siblings, removed when that one's path matches
+    std::vector<std::string> siblings;
+    // Reports the files that would be removed without removing anything, directories are not reported
+    bool dryRun = false;
+    // Both get paths relative to the root and are called from the worker threads
+    std::function<void(std::string_view, int)> *onError = nullptr;
+    std::function<void(std::string_view, bool)> *onRemove = nullptr;
+};
+
+/*
+ * Removes the files matching a glob below `root` on a thread pool, in the background. Every directory is read once
+ * and its matches are unlinked relative to its descriptor, directories that end up empty are removed bottom-up.
+ * Writers call claim() for the directory they are about to write into: it returns as soon as that directory itself
+ * has been cleaned, while the rest of the tree may still be in progress, and keeps it from being removed afterwards.
+ */
+class Cleaner {
+public:
+    Cleaner(const std::string &root, CleanOpts opts);
+    ~Cleaner();
+    Cleaner(const Cleaner &) = delete;
+    Cleaner &operator=(const Cleaner &) = delete;
+
+    // `dir` is relative to the root, "" for the root itself
+    void claim(std::string_view dir);
+    // Blocks until the whole tree is clean, returns the number of removed files
+    size_t wait();
+
+private:
+    struct Node {
+        const std::string *path;
+        Node *parent;
+        size_t pending;
+        bool matched;
+        bool scanned;
+        bool claimed;
+        bool removedAny;
+        bool removed;
+    };
+
+    CleanOpts _opts;
+    int _rootFd = -1;
+    std::mutex _mtx;
+    std::condition_variable _work;
+    std::condition_variable _state;
+    std::unordered_map<std::string, Node> _nodes;
+    std::deque<Node *> _queue;
+    std::vector<std::thread> _threads;
+    std::atomic<bool> _finished{false};
+    std::atomic<size_t> _removed{0};
+
+    void work();
+    void scan(Node *n);
+    void finish(Node *n);
+};
@@ -0,0 +1,323 @@
+#include <mutex>
+#include <cctype>
+#include <cerrno>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <cstring>
+#include <unistd.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include "copy.hpp"
+#include "compress.hpp"
+#include "stats.hpp"
+
+using namespace std;
+
+// Set on a destination whose sibling with this suffix was not smaller, to the mtime in ns of the source it was tried for
+const string SKIP_XATTR = "user.cpx.skip";
+
+// Encodes `in` into `out` with the codec's functions, in the order of CompressCodec::symbols
+typedef bool (*Encode)(void *const *fns, int level, const unsigned char *in, size_t len, vector<unsigned char> &out);
+
+struct CompressCodec {
+    const char *name;
+    const char *alias;
+    const char *suffix;
+    const char *library;
+    const char *symbols[3];
+    int minLevel;
+    int maxLevel;
+    // Levels for files compressed once and served many times
+    int defaultLevel;
+    Encode encode;
+    once_flag loaded;
+    void *fns[3];
+    string error;
+};
+
+static void putLe32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = v >> (8 * i);
+    }
+}
+
+static bool gzip(void *const *fns, int level, const unsigned char *in, size_t len, vector<unsigned char> &out) {
+    auto bound = (unsigned long (*)(unsigned long))fns[0];
+    auto compress2 = (int (*)(unsigned char *, unsigned long *, const unsigned char *, unsigned long, int))fns[1];
+    auto crc32 = (unsigned long (*)(unsigned long, const unsigned char *, unsigned))fns[2];
+    // compress2 writes the zlib format, the same deflate stream as gzip between a 2 byte header and an adler32. It
+    // goes 8 bytes in so the gzip header can replace the zlib one.
+    unsigned long n = bound(len);
+    out.resize(8 + n + 4);
+    if (compress2(out.data() + 8, &n, in, len, level) != 0 || n < 6) return false;
+    const unsigned char header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, (unsigned char)(level >= 9 ? 2 : level == 1 ? 4 : 0), 3};
+    memcpy(out.data(), header, sizeof(header));
+    unsigned long crc = crc32(0, nullptr, 0);
+    for (size_t off = 0; off < len;) {
+        unsigned chunk = min(len - off, (size_t)1 << 30);
+        crc = crc32(crc, in + off, chunk);
+        off += chunk;
+    }
+    size_t end = 8 + n - 4;
+    out.resize(end + 8);
+    putLe32(out.data() + end, crc);
+    putLe32(out.data() + end + 4, len);
+    return true;
+}
+
+static bool brotli(void *const *fns, int level, const unsigned char *in, size_t len, vector<unsigned char> &out) {
+    auto bound = (size_t (*)(size_t))fns[0];
+    auto compress = (int (*)(int, int, int, size_t, const uint8_t *, size_t *, uint8_t *))fns[1];
+    size_t n = bound(len);
+    if (n == 0) return false;
+    out.resize(n);
+    // the default window of 4MB (lgwin 22) in generic mode
+    if (!compress(level, 22, 0, len, in, &n, out.data())) return false;
+    out.resize(n);
+    return true;
+}
+
+static bool zstd(void *const *fns, int level, const unsigned char *in, size_t len, vector<unsigned char> &out) {
+    auto bound = (size_t (*)(size_t))fns[0];
+    auto compress = (size_t (*)(void *, size_t, const void *, size_t, int))fns[1];
+    auto isError = (unsigned (*)(size_t))fns[2];
+    out.resize(bound(len));
+    size_t n = compress(out.data(), out.size(), in, len, level);
+    if (isError(n)) return false;
+    out.resize(n);
+    return true;
+}
+
+static CompressCodec CODECS[] = {
+    {"gz", "gzip", ".gz", "libz.so.1", {"compressBound", "compress2", "crc32"}, 1, 9, 9, gzip},
+    {"br", "brotli", ".br", "libbrotlienc.so.1", {"BrotliEncoderMaxCompressedSize", "BrotliEncoderCompress"}, 0, 11, 11, brotli},
+    {"zst", "zstd", ".zst", "libzstd.so.1", {"ZSTD_compressBound", "ZSTD_compress", "ZSTD_isError"}, 1, 22, 19, zstd},
+};
+
+vector<CompressLevel> parseCompress(const vector<string> &values) {
+    vector<CompressLevel> levels;
+    for (const string &value : values) {
+        for (size_t pos = 0; pos <= value.size();) {
+            size_t comma = min(value.find(',', pos), value.size());
+            string item = value.substr(pos, comma - pos);
+            pos = comma + 1;
+            size_t colon = item.find(':');
+            string name = item.substr(0, colon);
+            size_t f = 0;
+            while (f < size(CODECS) && name != CODECS[f].name && name != CODECS[f].alias) f++;
+            if (f == size(CODECS)) throw runtime_error("Invalid compress format: " + item + " (gz, br or zst)");
+            int level = CODECS[f].defaultLevel;
+            if (colon != string::npos) {
+                size_t end = 0;
+                try {
+                    level = stoi(item.substr(colon + 1), &end);
+                } catch (const exception &) {
+                    end = 0;
+                }
+                if (end == 0 || colon + 1 + end != item.size() || level < CODECS[f].minLevel || level > CODECS[f].maxLevel) {
+                    throw runtime_error("Invalid compress level: " + item + " (" + to_string(CODECS[f].minLevel) + " to "
+                                        + to_string(CODECS[f].maxLevel) + ")");
+                }
+            }
+            erase_if(levels, [f](const CompressLevel &l) { return (size_t)l.format == f; });
+            levels.push_back(CompressLevel{(CompressFormat)f, level});
+        }
+    }
+    return levels;
+}
+
+Compressor::Compressor(CompressOpts opts) : _opts(opts) {
+    for (const CompressLevel &l : _opts.formats) {
+        CompressCodec &c = CODECS[(size_t)l.format];
+        call_once(c.loaded, [&c]() {
+            // loaded for good, the functions are used until the process exits
+            void *handle = dlopen(c.library, RTLD_NOW | RTLD_LOCAL);
+            for (size_t i = 0; handle != nullptr && i < size(c.symbols) && c.symbols[i] != nullptr; i++) {
+                c.fns[i] = dlsym(handle, c.symbols[i]);
+                if (c.fns[i] == nullptr) c.error = string(c.library) + " has no " + c.symbols[i];
+            }
+            if (handle == nullptr) c.error = dlerror();
+        });
+        if (!c.error.empty()) throw runtime_error("Cannot compress to " + string(c.suffix) + ": " + c.error);
+        _codecs.emplace_back(&c, l.level);
+        _suffixes.push_back(c.suffix);
+    }
+    unsigned n = _opts.threads > 0 ? _opts.threads : max(1u, thread::hardware_concurrency());
+    for (unsigned i = 0; i < n; i++) {
+        _threads.emplace_back(&Compressor::work, this);
+    }
+}
+
+Compressor::~Compressor() {
+    {
+        lock_guard<mutex> lock(_mtx);
+        _closing = true;
+    }
+    _work.notify_all();
+    for (thread &t : _threads) {
+        t.join();
+    }
+}
+
+bool Compressor::compressible(string_view path) {
+    static const char *exts[] = {"html", "htm", "css", "js", "mjs", "cjs", "json", "map", "svg", "xml", "txt", "csv",
+                                 "md", "wasm", "webmanifest", "ico", "ttf", "otf"};
+    size_t dot = path.find_last_of("./");
+    if (dot == string_view::npos || path[dot] != '.') return false;
+    string_view ext = path.substr(dot + 1);
+    for (const char *e : exts) {
+        if (ext.size() == strlen(e) && equal(ext.begin(), ext.end(), e, [](char a, char b) { return tolower(a) == b; })) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Compressor::submit(const string &src, const string &from, const string &dst) {
+    lock_guard<mutex> lock(_mtx);
+    auto [it, added] = _busy.try_emplace(dst);
+    if (!added) {
+        it->second = Job{src, from, dst};
+        return;
+    }
+    _queue.push_back(Job{src, from, dst});
+    _work.notify_one();
+}
+
+void Compressor::remove(const string &dst) {
+    for (const string &suffix : _suffixes) {
+        stats.sys(Sys::Unlink);
+        unlink((dst + suffix).c_str());
+    }
+}
+
+size_t Compressor::wait() {
+    unique_lock<mutex> lock(_mtx);
+    _idle.wait(lock, [this]() { return _busy.empty(); });
+    return _failed.exchange(0);
+}
+
+void Compressor::work() {
+    unique_lock<mutex> lock(_mtx);
+    for (;;) {
+        _work.wait(lock, [this]() { return !_queue.empty() || _closing; });
+        if (_queue.empty()) return;
+        Job job = move(_queue.front());
+        _queue.pop_front();
+        lock.unlock();
+        run(job);
+        lock.lock();
+        auto it = _busy.find(job.dst);
+        if (it->second) {
+            _queue.push_back(move(*it->second));
+            it->second.reset();
+            _work.notify_one();
+        } else {
+            _busy.erase(it);
+        }
+        if (_busy.empty()) _idle.notify_all();
+    }
+}
+
+void Compressor::run(const Job &job) {
+    auto fail = [this, &job](const string &error) {
+        _failed++;
+        if (_opts.onError != nullptr) (*_opts.onError)(job.dst, "Cannot compress " + job.dst + ": " + error);
+    };
+    struct stat st;
+    stats.sys(Sys::Stat);
+    if (stat(job.src.c_str(), &st) != 0) {
+        // removed since, its siblings would be stale
+        if (errno == ENOENT) remove(job.dst);
+        else fail(strerror(errno));
+        return;
+    }
+    thread_local vector<pair<const CompressCodec *, int>> todo;
+    todo.clear();
+    int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    for (auto &[codec, level] : _codecs) {
+        struct stat cs;
+        stats.sys(Sys::Stat);
+        bool fresh = stat((job.dst + codec->suffix).c_str(), &cs) == 0 && (cs.st_mtim.tv_sec > st.st_mtim.tv_sec
+                     || (cs.st_mtim.tv_sec == st.st_mtim.tv_sec && cs.st_mtim.tv_nsec >= st.st_mtim.tv_nsec));
+        // or it was found not worth writing for this version of the source already
+        int64_t skipped;
+        if (!fresh) fresh = getxattr(job.dst.c_str(), (SKIP_XATTR + codec->suffix).c_str(), &skipped, sizeof(skipped))
+                            == sizeof(skipped) && skipped >= mtime;
+        if (!fresh) todo.emplace_back(codec, level);
+    }
+    if (todo.empty()) return;
+
+    PhaseTimer timer(Phase::Compress);
+    int in = open(job.from.c_str(), O_RDONLY | O_CLOEXEC);
+    stats.sys(Sys::Open);
+    struct stat fs;
+    if (in < 0 || fstat(in, &fs) != 0) {
+        fail(strerror(errno));
+        if (in >= 0) close(in);
+        return;
+    }
+    if (fs.st_size < _opts.minSize) {
+        close(in);
+        remove(job.dst);
+        return;
+    }
+    // the bytes that were just copied, straight from the page cache; read rather than mapped as `from` may be the
+    // source, which can be truncated meanwhile
+    thread_local vector<unsigned char> data;
+    data.resize(fs.st_size);
+    size_t len = 0;
+    while (len < data.size()) {
+        ssize_t n = pread(in, data.data() + len, data.size() - len, len);
+        stats.sys(Sys::Read);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            fail(strerror(errno));
+            close(in);
+            return;
+        }
+        if (n == 0) break;
+        len += n;
+    }
+    close(in);
+    thread_local vector<unsigned char> out;
+    for (auto &[codec, level] : todo) {
+        string sibling = job.dst + codec->suffix;
+        string skip = SKIP_XATTR + codec->suffix;
+        if (!codec->encode(codec->fns, level, data.data(), len, out)) {
+            fail(string(codec->name) + " failed");
+            continue;
+        }
+        // not worth sending, and a sibling left from an older version would be served instead of the file. Where
+        // the filesystem has no xattrs it is tried again every time.
+        if (out.size() >= len) {
+            stats.sys(Sys::Unlink);
+            unlink(sibling.c_str());
+            setxattr(job.dst.c_str(), skip.c_str(), &mtime, sizeof(mtime), 0);
+            continue;
+        }
+        try {
+            TempFile tmp(sibling, st.st_mode & 0777);
+            for (size_t w = 0; w < out.size();) {
+                stats.sys(Sys::Write);
+                ssize_t n = write(tmp.fd(), out.data() + w, out.size() - w);
+                if (n < 0 && errno != EINTR) throw runtime_error(sibling + ": " + strerror(errno));
+                if (n > 0) w += n;
+            }
+            // the source's mtime, which is what makes it fresh the next time
+            timespec times[2] = {{0, UTIME_NOW}, st.st_mtim};
+            if (futimens(tmp.fd(), times) != 0) throw runtime_error(sibling + ": " + strerror(errno));
+            tmp.commit();
+        } catch (const exception &e) {
+            fail(e.what());
+            continue;
+        }
+        removexattr(job.dst.c_str(), skip.c_str());
+        stats.add(Counter::FilesCompressed);
+        if (_opts.onWrite != nullptr) (*_opts.onWrite)(job.dst, sibling);
+    }
+}
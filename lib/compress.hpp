@@ -0,0 +1,87 @@
+#pragma once
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <optional>
+#include <sys/types.h>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+#include <condition_variable>
+
+enum class CompressFormat : uint8_t { Gzip, Brotli, Zstd };
+
+struct CompressCodec;
+
+struct CompressLevel {
+    CompressFormat format;
+    int level;
+};
+
+// Parses `--compress` values: lists like "gz,br" of gz, br and zst, each optionally with a level as in "br:9"
+std::vector<CompressLevel> parseCompress(const std::vector<std::string> &values);
+
+class CompressOpts {
+public:
+    unsigned threads = 0;
+    std::vector<CompressLevel> formats;
+    // Smaller files are not worth a request for the compressed version
+    off_t minSize = 1024;
+    // Both are called from the worker threads, with the destination and the written sibling or the error
+    std::function<void(const std::string &, const std::string &)> *onWrite = nullptr;
+    std::function<void(const std::string &, const std::string &)> *onError = nullptr;
+};
+
+/*
+ * Writes precompressed .gz, .br and .zst siblings of copied web assets on a thread pool, for servers that send them
+ * as they are (nginx gzip_static and the like). The codecs are the system's zlib, brotli and zstd libraries, loaded
+ * with dlopen when a format is asked for. A sibling gets the mtime of the source and is skipped while that is not
+ * older than the source's, the rule of --update, so running again only compresses what changed. Siblings that would
+ * not be smaller than the file are not written, an xattr on the destination remembers that for the source's mtime.
+ */
+class Compressor {
+public:
+    explicit Compressor(CompressOpts opts);
+    ~Compressor();
+    Compressor(const Compressor &) = delete;
+    Compressor &operator=(const Compressor &) = delete;
+
+    // Whether `path` is a text-like asset that compresses well
+    static bool compressible(std::string_view path);
+    const std::vector<std::string> &suffixes() const { return _suffixes; }
+
+    // Compresses `from`, the content of `dst`, into siblings of `dst`; `src` is the source whose mtime they follow.
+    // A destination that is being compressed is done again afterwards.
+    void submit(const std::string &src, const std::string &from, const std::string &dst);
+    // Removes the siblings of `dst`
+    void remove(const std::string &dst);
+    // Blocks until everything submitted is done, returns the number of files that failed since the last call
+    size_t wait();
+
+private:
+    struct Job {
+        std::string src;
+        std::string from;
+        std::string dst;
+    };
+    CompressOpts _opts;
+    std::vector<std::string> _suffixes;
+    std::vector<std::pair<CompressCodec *, int>> _codecs;
+    std::mutex _mtx;
+    std::condition_variable _work;
+    std::condition_variable _idle;
+    std::deque<Job> _queue;
+    // Destinations being compressed, with the job to run for them next
+    std::unordered_map<std::string, std::optional<Job>> _busy;
+    std::vector<std::thread> _threads;
+    bool _closing = false;
+    std::atomic<size_t> _failed{0};
+
+    void work();
+    void run(const Job &job);
+};
@@ -0,0 +1,366 @@
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <cerrno>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <cstring>
+#include <unistd.h>
+#include <optional>
+#include <algorithm>
+#include <linux/fs.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <shared_mutex>
+#include <sys/sendfile.h>
+#include "copy.hpp"
+#include "stats.hpp"
+
+using namespace std;
+
+const size_t CHUNK = 1 << 30;
+// cancellable copies go in smaller steps so a stale copy stops soon
+const size_t CANCEL_CHUNK = 8 << 20;
+// ranges of a parallel copy are at least this big and start at multiples of RANGE_ALIGN
+const off_t MIN_RANGE = 16 << 20;
+const off_t RANGE_ALIGN = 1 << 20;
+const size_t BUF_SIZE = 128 * 1024;
+
+static bool unsupported(int err) {
+    return err == EOPNOTSUPP || err == ENOTSUP || err == EXDEV || err == EINVAL || err == ENOSYS || err == ENOTTY
+           || err == EBADF;
+}
+
+// Errors that mean a method can never work between two filesystems, the others only fail this file or this offset
+static bool permanent(int err) {
+    return err == EOPNOTSUPP || err == ENOTSUP || err == EXDEV || err == ENOSYS;
+}
+
+void mkdirs(const string &dir) {
+    stats.sys(Sys::Mkdir);
+    if (dir.empty() || mkdir(dir.c_str(), 0777) == 0 || errno == EEXIST) return;
+    if (errno != ENOENT) throw runtime_error("Cannot create " + dir + ": " + strerror(errno));
+    size_t slash = dir.find_last_of('/', dir.size() - 1);
+    if (slash == string::npos || slash == 0) throw runtime_error("Cannot create " + dir + ": " + strerror(ENOENT));
+    mkdirs(dir.substr(0, slash));
+    stats.sys(Sys::Mkdir);
+    if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+        throw runtime_error("Cannot create " + dir + ": " + strerror(errno));
+    }
+}
+
+// Numbers the temporary files of this process
+static atomic<unsigned> temps{0};
+
+// Opens `path` next to `dst`, creating the directories above `dst` when they are missing
+static int create(const string &path, const string &dst, int flags, mode_t mode) {
+    int fd = open(path.c_str(), flags, mode);
+    stats.sys(Sys::Open);
+    size_t slash = dst.find_last_of('/');
+    if (fd >= 0 || errno != ENOENT || slash == string::npos || slash == 0) return fd;
+    mkdirs(dst.substr(0, slash));
+    stats.sys(Sys::Open);
+    return open(path.c_str(), flags, mode);
+}
+
+void copyAttrs(int fd, const struct stat &st, bool preserve) {
+    // ownership can only be given away with privileges, the rest still applies without them. It goes first, a
+    // change of owner clears the setuid and setgid bits.
+    if (preserve && fchown(fd, st.st_uid, st.st_gid) != 0 && errno != EPERM) throw runtime_error(strerror(errno));
+    fchmod(fd, st.st_mode & 07777);
+    if (!preserve) return;
+    timespec times[2] = {st.st_atim, st.st_mtim};
+    if (futimens(fd, times) != 0) throw runtime_error(strerror(errno));
+}
+
+TempFile::TempFile(const string &dst, mode_t mode)
+    : _dst(dst), _path(dst + ".cpx-" + to_string(getpid()) + "-" + to_string(temps++)) {
+    _fd = create(_path, dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    if (_fd < 0) throw runtime_error("Cannot open " + _path + ": " + strerror(errno));
+}
+
+TempFile::~TempFile() {
+    discard();
+}
+
+void TempFile::commit() {
+    int fd = _fd;
+    _fd = -1;
+    if (close(fd) != 0) {
+        int err = errno;
+        discard();
+        throw runtime_error("Cannot write " + _dst + ": " + strerror(err));
+    }
+    if (rename(_path.c_str(), _dst.c_str()) != 0) {
+        int err = errno;
+        discard();
+        throw runtime_error("Cannot replace " + _dst + ": " + strerror(err));
+    }
+    _done = true;
+}
+
+void TempFile::discard() {
+    if (_done) return;
+    _done = true;
+    if (_fd >= 0) close(_fd);
+    _fd = -1;
+    unlink(_path.c_str());
+}
+
+uint8_t CopyEngine::broken(dev_t src, dev_t dst) {
+    shared_lock<shared_mutex> lock(_mtx);
+    auto it = _broken.find({src, dst});
+    return it == _broken.end() ? 0 : it->second;
+}
+
+void CopyEngine::markBroken(dev_t src, dev_t dst, Method m) {
+    unique_lock<shared_mutex> lock(_mtx);
+    _broken[{src, dst}] |= m;
+}
+
+bool CopyEngine::copyData(int in, int out, off_t size, dev_t sdev, dev_t ddev, const atomic<bool> *cancel) {
+    uint8_t skip = broken(sdev, ddev);
+    off_t done = 0;
+    size_t chunk = cancel != nullptr ? CANCEL_CHUNK : CHUNK;
+    auto cancelled = [cancel]() { return cancel != nullptr && cancel->load(memory_order_relaxed); };
+    if (!(skip & Reflink)) {
+        stats.sys(Sys::Ficlone);
+        if (ioctl(out, FICLONE, in) == 0) return true;
+        if (permanent(errno)) markBroken(sdev, ddev, Reflink);
+    }
+    if (!(skip & CopyRange)) {
+        while (done < size) {
+            if (cancelled()) return false;
+            ssize_t n = copy_file_range(in, nullptr, out, nullptr, min((size_t)(size - done), chunk), 0);
+            stats.sys(Sys::CopyRange);
+            if (n <= 0) {
+                if (n < 0 && !unsupported(errno)) throw runtime_error(strerror(errno));
+                if (n < 0 && permanent(errno)) markBroken(sdev, ddev, CopyRange);
+                break;
+            }
+            done += n;
+        }
+        if (done >= size) return true;
+    }
+    if (!(skip & Sendfile)) {
+        while (done < size) {
+            if (cancelled()) return false;
+            ssize_t n = sendfile(out, in, nullptr, min((size_t)(size - done), chunk));
+            stats.sys(Sys::Sendfile);
+            if (n <= 0) {
+                if (n < 0 && !unsupported(errno)) throw runtime_error(strerror(errno));
+                if (n < 0 && permanent(errno)) markBroken(sdev, ddev, Sendfile);
+                break;
+            }
+            done += n;
+        }
+        if (done >= size) return true;
+    }
+    // the file may also have grown since fstat, so read until EOF here
+    thread_local vector<char> buf(BUF_SIZE);
+    posix_fadvise(in, done, 0, POSIX_FADV_SEQUENTIAL);
+    for (size_t since = 0;; since += buf.size()) {
+        if (since >= chunk) {
+            if (cancelled()) return false;
+            since = 0;
+        }
+        ssize_t n = read(in, buf.data(), buf.size());
+        stats.sys(Sys::Read);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error(strerror(errno));
+        }
+        for (ssize_t w = 0; w < n;) {
+            ssize_t m = write(out, buf.data() + w, n - w);
+            stats.sys(Sys::Write);
+            if (m < 0) {
+                if (errno == EINTR) continue;
+                throw runtime_error(strerror(errno));
+            }
+            w += m;
+        }
+    }
+    return true;
+}
+
+// Copies from `done` up to `to` and advances `done`, which stays short of `to` when the source got shorter
+bool CopyEngine::copyRange(int in, int out, off_t &done, off_t to, dev_t sdev, dev_t ddev, const atomic<bool> *cancel) {
+    if (!(broken(sdev, ddev) & CopyRange)) {
+        while (done < to) {
+            if (cancel != nullptr && cancel->load(memory_order_relaxed)) return false;
+            loff_t ioff = done, ooff = done;
+            ssize_t n = copy_file_range(in, &ioff, out, &ooff, min((size_t)(to - done), CANCEL_CHUNK), 0);
+            stats.sys(Sys::CopyRange);
+            if (n <= 0) {
+                if (n < 0 && !unsupported(errno)) throw runtime_error(strerror(errno));
+                if (n < 0 && permanent(errno)) markBroken(sdev, ddev, CopyRange);
+                break;
+            }
+            done += n;
+        }
+    }
+    thread_local vector<char> buf(BUF_SIZE);
+    while (done < to) {
+        if (cancel != nullptr && cancel->load(memory_order_relaxed)) return false;
+        ssize_t n = pread(in, buf.data(), min((size_t)(to - done), buf.size()), done);
+        stats.sys(Sys::Read);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error(strerror(errno));
+        }
+        for (ssize_t w = 0; w < n;) {
+            ssize_t m = pwrite(out, buf.data() + w, n - w, done + w);
+            stats.sys(Sys::Write);
+            if (m < 0) {
+                if (errno == EINTR) continue;
+                throw runtime_error(strerror(errno));
+            }
+            w += m;
+        }
+        done += n;
+    }
+    return true;
+}
+
+bool CopyEngine::copyRanges(int in, int out, off_t size, dev_t sdev, dev_t ddev, const atomic<bool> *cancel) {
+    if (!(broken(sdev, ddev) & Reflink)) {
+        stats.sys(Sys::Ficlone);
+        if (ioctl(out, FICLONE, in) == 0) return true;
+        if (permanent(errno)) markBroken(sdev, ddev, Reflink);
+    }
+    // allocated in one go the concurrently written ranges don't interleave on disk
+    if (fallocate(out, 0, 0, size) != 0 && !unsupported(errno)) throw runtime_error(strerror(errno));
+    // big files copied at once share the cores rather than each starting a thread per core
+    struct Running {
+        atomic<unsigned> &count;
+        ~Running() { count--; }
+    } running{_ranged};
+    off_t threads = max(1u, thread::hardware_concurrency() / ++_ranged);
+    off_t n = clamp<off_t>(size / MIN_RANGE, 1, threads);
+    off_t step = (size / n + RANGE_ALIGN - 1) / RANGE_ALIGN * RANGE_ALIGN;
+    vector<thread> workers;
+    mutex mtx;
+    string error;
+    atomic<bool> stopped{false};
+    // where the source ended, if it is shorter now than when the copy started
+    off_t end = size;
+    auto part = [&](off_t from, off_t to) {
+        try {
+            off_t done = from;
+            if (!copyRange(in, out, done, to, sdev, ddev, cancel)) stopped = true;
+            lock_guard<mutex> lock(mtx);
+            if (done < to) end = min(end, done);
+        } catch (const exception &e) {
+            lock_guard<mutex> lock(mtx);
+            error = e.what();
+            stopped = true;
+        }
+    };
+    for (off_t from = step; from < size; from += step) {
+        workers.emplace_back(part, from, min(size, from + step));
+    }
+    part(0, min(size, step));
+    for (thread &t : workers) {
+        t.join();
+    }
+    if (!error.empty()) throw runtime_error(error);
+    if (!stopped && end < size && ftruncate(out, end) != 0) throw runtime_error(strerror(errno));
+    return !stopped;
+}
+
+bool CopyEngine::identical(int in, const struct stat &st, const string &dst, uint64_t &hash) {
+    hash = 0;
+    int fd = open(dst.c_str(), O_RDONLY | O_CLOEXEC);
+    stats.sys(Sys::Open);
+    if (fd < 0) return false;
+    struct stat dt;
+    uint64_t dh;
+    bool same = fstat(fd, &dt) == 0 && S_ISREG(dt.st_mode) && dt.st_size == st.st_size && _hashes.get(in, st, hash)
+                && _hashes.get(fd, dt, dh) && dh == hash;
+    close(fd);
+    return same;
+}
+
+CopyStatus CopyEngine::copy(const string &src, const string &dst, const CopyOpts &opts) {
+    // O_NONBLOCK has no effect on regular files, and keeps a FIFO that came through a watch event from blocking
+    int in = open(src.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    stats.sys(Sys::Open);
+    stats.sys(Sys::Stat, 1 + opts.update);
+    if (in < 0) throw runtime_error("Cannot open " + src + ": " + strerror(errno));
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        close(in);
+        throw runtime_error("Cannot stat " + src + ": " + strerror(errno));
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(in);
+        throw runtime_error("Cannot copy " + src + ": not a regular file");
+    }
+    if (opts.update) {
+        struct stat dt;
+        bool newer = stat(dst.c_str(), &dt) == 0 && (dt.st_mtim.tv_sec > st.st_mtim.tv_sec
+                     || (dt.st_mtim.tv_sec == st.st_mtim.tv_sec && dt.st_mtim.tv_nsec >= st.st_mtim.tv_nsec));
+        if (newer) {
+            close(in);
+            return CopyStatus::Older;
+        }
+    }
+    uint64_t hash = 0;
+    if (opts.skipIdentical && identical(in, st, dst, hash)) {
+        close(in);
+        return CopyStatus::Identical;
+    }
+    if (opts.cancel != nullptr && opts.cancel->load()) {
+        close(in);
+        return CopyStatus::Cancelled;
+    }
+    // a big file is assembled next to the destination and only replaces it when complete, and so is a copy that can
+    // be cancelled: a partial destination would be newer than the source and look up to date to -u
+    bool ranged = opts.parallelThreshold > 0 && st.st_size >= opts.parallelThreshold;
+    optional<TempFile> temp;
+    int out;
+    try {
+        if (ranged || opts.cancel != nullptr) temp.emplace(dst, st.st_mode & 07777);
+        out = temp ? temp->fd() : create(dst, dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+    } catch (...) {
+        close(in);
+        throw;
+    }
+    if (out < 0) {
+        int err = errno;
+        close(in);
+        throw runtime_error("Cannot open " + dst + ": " + strerror(err));
+    }
+    auto discard = [&]() {
+        close(in);
+        if (temp) temp->discard();
+        else close(out);
+    };
+
+    try {
+        struct stat dt;
+        if (fstat(out, &dt) != 0) throw runtime_error(strerror(errno));
+        stats.add(Counter::BytesCopied, st.st_size);
+        bool complete = ranged ? copyRanges(in, out, st.st_size, st.st_dev, dt.st_dev, opts.cancel)
+                               : st.st_size == 0 || copyData(in, out, st.st_size, st.st_dev, dt.st_dev, opts.cancel);
+        if (!complete) {
+            discard();
+            return CopyStatus::Cancelled;
+        }
+        copyAttrs(out, st, opts.preserve);
+        // the destination now has the source's content, remember that so the next comparison doesn't read it
+        if (hash != 0 && fstat(out, &dt) == 0) _hashes.put(dt, hash);
+    } catch (const exception &e) {
+        discard();
+        throw runtime_error("Cannot copy " + src + " to " + dst + ": " + e.what());
+    }
+    close(in);
+    if (temp) temp->commit();
+    else if (close(out) != 0) throw runtime_error("Cannot write " + dst + ": " + strerror(errno));
+    return CopyStatus::Copied;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <map>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <utility>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <shared_mutex>
+#include "hash.hpp"
+
+class CopyOpts {
+public:
+    bool preserve = false;
+    bool update = false;
+    // Compare content hashes and leave byte-identical destinations untouched
+    bool skipIdentical = false;
+    // Checked between chunks. A cancellable copy is written to a TempFile, a cancelled one leaves the destination as it was
+    const std::atomic<bool> *cancel = nullptr;
+    // Files of at least this many bytes are copied in ranges on several threads into a preallocated temporary file
+    // that is renamed over the destination once complete, 0 turns that off
+    off_t parallelThreshold = 0;
+};
+
+enum class CopyStatus { Copied, Older, Identical, Cancelled };
+
+/*
+ * Copies file contents inside the kernel where possible: FICLONE reflink, then copy_file_range, then sendfile, then a
+ * userspace read/write loop. A method that fails for a pair of filesystems is remembered and not tried again for it.
+ */
+class CopyEngine {
+public:
+    CopyStatus copy(const std::string &src, const std::string &dst, const CopyOpts &opts);
+
+private:
+    enum Method : uint8_t { Reflink = 1, CopyRange = 2, Sendfile = 4 };
+    std::shared_mutex _mtx;
+    std::map<std::pair<dev_t, dev_t>, uint8_t> _broken;
+    HashCache _hashes;
+    // Ranged copies running now
+    std::atomic<unsigned> _ranged{0};
+
+    uint8_t broken(dev_t src, dev_t dst);
+    void markBroken(dev_t src, dev_t dst, Method m);
+    bool copyData(int in, int out, off_t size, dev_t sdev, dev_t ddev, const std::atomic<bool> *cancel);
+    bool copyRanges(int in, int out, off_t size, dev_t sdev, dev_t ddev, const std::atomic<bool> *cancel);
+    bool copyRange(int in, int out, off_t &done, off_t to, dev_t sdev, dev_t ddev, const std::atomic<bool> *cancel);
+    bool identical(int in, const struct stat &st, const std::string &dst, uint64_t &hash);
+};
+
+void mkdirs(const std::string &dir);
+// Gives `fd` the mode of `st` and with `preserve` also its owner and times, throws with the errno message
+void copyAttrs(int fd, const struct stat &st, bool preserve);
+
+/*
+ * A file written next to `dst` as `dst`.cpx-PID-N, creating missing directories above it, that replaces `dst` in one
+ * rename on commit(). Until then `dst` keeps its previous content, and a file never committed is removed.
+ */
+class TempFile {
+public:
+    TempFile(const std::string &dst, mode_t mode);
+    ~TempFile();
+    TempFile(const TempFile &) = delete;
+    TempFile &operator=(const TempFile &) = delete;
+
+    int fd() const { return _fd; }
+    // Closes the file and renames it over the destination, throws (and discards it) on failure
+    void commit();
+    void discard();
+
+private:
+    std::string _dst;
+    std::string _path;
+    int _fd = -1;
+    bool _done = false;
+};
@@ -0,0 +1,669 @@
+#include <mutex>
+#include <atomic>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <dirent.h>
+#include <unistd.h>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <functional>
+#include <string_view>
+#include "cpx.hpp"
+#include "walk.hpp"
+#include "log.hpp"
+#include "../pkgs/co/chokidar.hpp"
+
+using namespace std;
+
+const unsigned URING_DEPTH = 64;
+const size_t URING_MAX_SIZE = 64 * 1024;
+const size_t URING_BATCH = 256;
+
+Cpx::Cpx(const vector<string> &sources, const string &outDir, CpxOpts opts) : _outDir(outDir), _opts(opts), _glob(sources) {
+    for (const string &s : sources) {
+        _source += (_source.empty() ? "" : " ") + s;
+    }
+    for (const string &file : _opts.ignoreFiles) {
+        ifstream in(file);
+        if (!in) throw runtime_error("Cannot read " + file);
+        stringstream text;
+        text << in.rdbuf();
+        size_t slash = file.find_last_of('/');
+        _glob.addIgnore(text.str(), slash == string::npos ? "" : string_view(file).substr(0, slash + 1));
+    }
+    _base = _glob.base();
+    _umask = umask(0);
+    umask(_umask);
+    if (_opts.update) {
+        string file = manifestPath(_source, _outDir);
+        if (!file.empty()) _manifest = make_unique<Manifest>(file, &_paths);
+    }
+    if (!_opts.commands.empty() && !_opts.transforms.empty()) {
+        throw runtime_error("--command and --transform can't be used together");
+    }
+    if (!_opts.commands.empty()) _transformer = make_unique<Transformer>(_opts.commands);
+    if (!_opts.transforms.empty()) _plugins = make_unique<PluginChain>(_opts.transforms);
+    if (!_opts.compress.empty()) {
+        CompressOpts co;
+        co.formats = parseCompress(_opts.compress);
+        _onCompressed = [this](const string &, const string &file) {
+            if (_opts.verbose) log("Compressed: " + file);
+        };
+        _onCompressError = [this](const string &, const string &error) { log(error, true); };
+        co.onWrite = &_onCompressed;
+        co.onError = &_onCompressError;
+        _compressor = make_unique<Compressor>(co);
+    }
+    while (_outDir.size() > 1 && _outDir.back() == '/') _outDir.pop_back();
+}
+
+string Cpx::src2dst(string_view path) const {
+    while (path.substr(0, 2) == "./") path.remove_prefix(2);
+    if (!_base.empty() && path.substr(0, _base.size()) == _base) {
+        path.remove_prefix(_base.size());
+        while (!path.empty() && path[0] == '/') path.remove_prefix(1);
+    }
+    string dst = _outDir;
+    if (!path.empty()) {
+        if (dst.back() != '/') dst += '/';
+        dst += path;
+    }
+    return dst;
+}
+
+// Verbose lines may be dropped when the output can't keep up, errors and the plan of a dry run never are
+void Cpx::log(const string &line, bool err) {
+    if (err) stats.add(Counter::Errors);
+    logger.write(err ? LogStream::Err : LogStream::Out, line, !err && !_opts.dryRun);
+}
+
+// Starts removing the files matching the source glob from the destination, copies wait per directory in claim()
+void Cpx::startClean() {
+    _cleaned = true;
+    _cleanStart = chrono::steady_clock::now();
+    char *from = realpath(_base.empty() ? "." : _base.c_str(), nullptr);
+    char *to = realpath(_outDir.c_str(), nullptr);
+    bool same = from != nullptr && to != nullptr && strcmp(from, to) == 0;
+    free(from);
+    free(to);
+    if (same) throw runtime_error("Cannot clean " + _outDir + ": it is the source directory");
+    _onCleanError = [this](string_view path, int err) {
+        _cleanErrors++;
+        log("Cannot remove " + _outDir + "/" + string(path) + ": " + strerror(err), true);
+    };
+    _onCleanRemove = [this](string_view path, bool) {
+        if (_opts.dryRun) log("unlink " + _outDir + "/" + string(path));
+        else if (_opts.verbose) log("Removed: " + _outDir + "/" + string(path));
+    };
+    CleanOpts co;
+    co.dryRun = _opts.dryRun;
+    co.glob = &_glob;
+    co.prefix = _base.empty() ? "" : _base + "/";
+    if (_compressor) co.siblings = _compressor->suffixes();
+    co.onError = &_onCleanError;
+    co.onRemove = &_onCleanRemove;
+    _cleaner = make_unique<Cleaner>(_outDir, co);
+}
+
+// Waits for the cleaning to complete, returns the number of files that could not be removed
+size_t Cpx::finishClean() {
+    if (!_cleaner) return 0;
+    _cleaner->wait();
+    _cleaner.reset();
+    stats.time(Phase::Clean, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - _cleanStart).count());
+    return _cleanErrors.exchange(0);
+}
+
+void Cpx::claim(const string &dst, bool dir) {
+    if (!_cleaner) return;
+    size_t from = min(dst.size(), _outDir.size() + 1);
+    size_t end = dir ? dst.size() : dst.find_last_of('/');
+    _cleaner->claim(end == string::npos || end <= from ? string_view() : string_view(dst).substr(from, end - from));
+}
+
+optional<CopyStatus> Cpx::copyFile(const string &src, const atomic<bool> *cancel) {
+    PhaseTimer timer(Phase::Copy);
+    string dst = src2dst(src);
+    claim(dst);
+    CopyOpts co;
+    co.cancel = cancel;
+    co.preserve = _opts.preserve;
+    co.update = _opts.update;
+    co.skipIdentical = _opts.skipIdentical;
+    co.parallelThreshold = _opts.parallelThreshold;
+    if (_transformer || _plugins) {
+        try {
+            struct stat ss, ds;
+            if (_opts.update && stat(src.c_str(), &ss) == 0 && stat(dst.c_str(), &ds) == 0
+                && (ds.st_mtim.tv_sec > ss.st_mtim.tv_sec
+                    || (ds.st_mtim.tv_sec == ss.st_mtim.tv_sec && ds.st_mtim.tv_nsec >= ss.st_mtim.tv_nsec))) {
+                stats.add(Counter::FilesSkipped);
+                compress(src, dst);
+                return CopyStatus::Older;
+            }
+            PhaseTimer transform(Phase::Transform);
+            if (_transformer) _transformer->run(src, dst, _opts.preserve);
+            else _plugins->run(src, dst, _opts.preserve);
+        } catch (const exception &e) {
+            log(e.what(), true);
+            return nullopt;
+        }
+        stats.add(Counter::FilesCopied);
+        stats.copyTime.record(timer.elapsed());
+        if (_opts.verbose) log("Copied: " + src + " --> " + dst);
+        compress(src, dst);
+        return CopyStatus::Copied;
+    }
+    CopyStatus status;
+    try {
+        status = _engine.copy(src, dst, co);
+        if (status == CopyStatus::Copied) stats.copyTime.record(timer.elapsed());
+        // only read at the end of the initial copy, for its summary
+        if (status == CopyStatus::Identical) _identical++;
+        if (status == CopyStatus::Cancelled && _opts.verbose) log("Superseded: " + src);
+        if (status == CopyStatus::Older || status == CopyStatus::Identical) stats.add(Counter::FilesSkipped);
+        if (status != CopyStatus::Cancelled) compress(src, dst);
+        if (status != CopyStatus::Copied) return status;
+    } catch (const exception &e) {
+        log(e.what(), true);
+        return nullopt;
+    }
+    stats.add(Counter::FilesCopied);
+    if (_opts.verbose) log("Copied: " + src + " --> " + dst);
+    return status;
+}
+
+// Queues the precompressed siblings of a destination that is in place, or was up to date already
+void Cpx::compress(const string &src, const string &dst) {
+    if (!_compressor || _opts.dryRun || !Compressor::compressible(dst)) return;
+    // a transformed file is compressed from what it became, a copy from its source, which was just read
+    _compressor->submit(src, _transformer || _plugins ? dst : src, dst);
+}
+
+// Hardlinks a file seen before to its first copy, links to copies that are not written yet are retried after the walk
+bool Cpx::linkSeen(const string &src, const struct stat &st) {
+    uint32_t id;
+    if (!S_ISREG(st.st_mode) || _inodes->insert(st, _paths.intern(src), id)) return false;
+    string path;
+    string first = src2dst(_paths.path(id, path));
+    // a big first copy is renamed into place when done, a link made before that would keep the old file
+    bool renamed = _opts.parallelThreshold > 0 && st.st_size >= _opts.parallelThreshold;
+    if (renamed || !linkFile(src, first)) {
+        lock_guard<mutex> lock(_linksMtx);
+        _links.emplace_back(src, first);
+    }
+    return true;
+}
+
+bool Cpx::linkFile(const string &src, const string &first) {
+    string dst = src2dst(src);
+    claim(dst);
+    try {
+        ensureDir(dst);
+    } catch (...) {
+        return false;
+    }
+    stats.sys(Sys::Link);
+    if (link(first.c_str(), dst.c_str()) != 0) {
+        if (errno != EEXIST) return false;
+        struct stat fs, ds;
+        stats.sys(Sys::Stat, 2);
+        if (stat(first.c_str(), &fs) != 0) return false;
+        if (lstat(dst.c_str(), &ds) == 0 && fs.st_dev == ds.st_dev && fs.st_ino == ds.st_ino) {
+            stats.add(Counter::FilesSkipped);
+            compress(src, dst);
+            return true;
+        }
+        stats.sys(Sys::Unlink);
+        stats.sys(Sys::Link);
+        if (unlink(dst.c_str()) != 0 || link(first.c_str(), dst.c_str()) != 0) return false;
+    }
+    stats.add(Counter::FilesLinked);
+    if (_opts.verbose) log("Linked: " + src + " --> " + dst);
+    compress(src, dst);
+    return true;
+}
+
+void Cpx::removeFile(const string &src, bool dir) {
+    string dst = src2dst(src);
+    if (_compressor && !dir) _compressor->remove(dst);
+    stats.sys(Sys::Unlink);
+    int r = dir ? rmdir(dst.c_str()) : unlink(dst.c_str());
+    // a directory moved out of the tree comes without events for what was in it, the copies of those go with it
+    if (r != 0 && dir && errno == ENOTEMPTY) {
+        removeBelow(src, dst);
+        r = rmdir(dst.c_str());
+    }
+    if (r != 0) {
+        if (errno != ENOENT && errno != ENOTEMPTY) log("Cannot remove " + dst + ": " + strerror(errno), true);
+        return;
+    }
+    stats.add(Counter::FilesRemoved);
+    if (_opts.verbose) log("Removed: " + dst);
+}
+
+// Removes the copies of the files that match the glob below `dst`, and the directories that end up empty
+void Cpx::removeBelow(const string &src, const string &dst) {
+    function<void(string_view, int)> onError = [this, &dst](string_view path, int err) {
+        log("Cannot remove " + dst + "/" + string(path) + ": " + strerror(err), true);
+    };
+    function<void(string_view, bool)> onRemove = [this, &src, &dst](string_view path, bool dir) {
+        if (!dir && _manifest) _manifest->forget(src + "/" + string(path));
+        if (_opts.verbose) log("Removed: " + dst + "/" + string(path));
+    };
+    CleanOpts co;
+    co.threads = 1;
+    co.glob = &_glob;
+    co.prefix = src + "/";
+    co.onError = &onError;
+    co.onRemove = &onRemove;
+    if (_compressor) co.siblings = _compressor->suffixes();
+    Cleaner cleaner(dst, co);
+    cleaner.wait();
+}
+
+// Runs on the scheduler's workers, jobs for one destination are never run concurrently
+void Cpx::runJob(const CopyJob &job, const atomic<bool> &cancel) {
+    const string &src = job.src;
+    switch (job.kind) {
+        case JobKind::Copy: {
+            optional<CopyStatus> status = copyFile(src, &cancel);
+            if (status && !cancel) {
+                stats.eventToCopy.record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - job.at).count());
+                struct stat st;
+                if (_manifest && stat(src.c_str(), &st) == 0) _manifest->record(src, st);
+            }
+            if (status == CopyStatus::Identical && _opts.verbose) log("Unchanged: " + src);
+            break;
+        }
+        case JobKind::MakeDir:
+            try {
+                mkdirs(src2dst(src));
+            } catch (const exception &e) {
+                log(e.what(), true);
+            }
+            break;
+        case JobKind::Remove:
+            removeFile(src, false);
+            if (_manifest) _manifest->forget(src);
+            break;
+        case JobKind::RemoveDir: removeFile(src, true); break;
+    }
+}
+
+void Cpx::ensureDir(const string &dst) {
+    size_t slash = dst.find_last_of('/');
+    if (slash == string::npos || slash == 0) return;
+    string dir = dst.substr(0, slash);
+    {
+        lock_guard<mutex> lock(_dirsMtx);
+        if (_dirs.count(dir) > 0) return;
+    }
+    mkdirs(dir);
+    lock_guard<mutex> lock(_dirsMtx);
+    _dirs.insert(dir);
+}
+
+// Small files are collected into batches for the io_uring copier, returns false if `e` has to go the regular way
+bool Cpx::queueSmall(const WalkEntry &e, const string &src, size_t &failed) {
+    struct stat st;
+    stats.sys(Sys::Stat);
+    if (fstatat(e.dirfd, e.name, &st, 0) != 0 || !S_ISREG(st.st_mode)) return false;
+    if ((size_t)st.st_size > URING_MAX_SIZE || (st.st_mode & _umask) != 0) return false;
+    string dst = src2dst(src);
+    try {
+        claim(dst);
+        ensureDir(dst);
+    } catch (...) {
+        return false;
+    }
+    vector<UringJob> full;
+    {
+        lock_guard<mutex> lock(_batchMtx);
+        _batch.push_back(UringJob{src, dst, st.st_size, st.st_mode});
+        if (_batch.size() < URING_BATCH) return true;
+        full.swap(_batch);
+    }
+    failed += runBatch(full);
+    return true;
+}
+
+size_t Cpx::runBatch(vector<UringJob> &jobs) {
+    thread_local UringCopier ring(URING_DEPTH, URING_MAX_SIZE);
+    size_t failed = 0;
+    auto fallback = [this, &failed](const UringJob &j) {
+        if (!copyFile(j.src)) failed++;
+    };
+    if (!ring.available()) {
+        for (UringJob &j : jobs) fallback(j);
+        return failed;
+    }
+    try {
+        PhaseTimer timer(Phase::Copy);
+        ring.copy(jobs, [this, &fallback](const UringJob &j, int err) {
+            // anything the ring could not do is retried synchronously, which also reports the error properly
+            if (err != 0) {
+                fallback(j);
+                return;
+            }
+            stats.add(Counter::FilesCopied);
+            stats.add(Counter::BytesCopied, j.size);
+            if (_opts.verbose) log("Copied: " + j.src + " --> " + j.dst);
+            compress(j.src, j.dst);
+        });
+    } catch (const exception &e) {
+        for (UringJob &j : jobs) fallback(j);
+    }
+    return failed;
+}
+
+void Cpx::saveManifest() {
+    if (!_manifest) return;
+    try {
+        _manifest->save();
+    } catch (const exception &e) {
+        log(e.what(), true);
+    }
+}
+
+// With -L the files reached twice through symlinks are tracked by inode and symlink cycles reported
+WalkOpts Cpx::walkOpts() {
+    WalkOpts wo;
+    wo.glob = &_glob;
+    wo.includeDirs = _opts.includeEmptyDirs;
+    wo.followSymlinks = _opts.dereference;
+    // transforms may depend on the path, their outputs are never shared
+    if (_opts.dereference && !_transformer && !_plugins) {
+        _inodes = make_unique<InodeSet>();
+        _onWalkError = [this](string_view path, int err) {
+            if (err == ELOOP && _opts.verbose) log("Skipped: " + string(path) + " (symlink cycle)");
+        };
+        wo.onError = &_onWalkError;
+    }
+    return wo;
+}
+
+size_t Cpx::copy() {
+    if (_opts.dryRun || _opts.order != PlanOrder::Walk) return copyPlanned();
+    atomic<size_t> failed{0};
+    if (_opts.clean && !_cleaned) startClean();
+    bool uring = _opts.uring && !_opts.update && !_opts.preserve && !_opts.skipIdentical && !_transformer && !_plugins;
+    WalkOpts wo = walkOpts();
+    // the scan phase includes the copies made during it
+    PhaseTimer scan(Phase::Scan);
+    walk(_base, wo, [this, &failed, uring](const WalkEntry &e) {
+        string src(e.path);
+        stats.add(Counter::EntriesMatched);
+        if (e.type == DT_DIR) {
+            try {
+                string dst = src2dst(src);
+                claim(dst, true);
+                mkdirs(dst);
+            } catch (const exception &ex) {
+                log(ex.what(), true);
+                failed++;
+            }
+            return;
+        }
+        if (_manifest) {
+            struct stat st;
+            stats.sys(Sys::Stat);
+            if (fstatat(e.dirfd, e.name, &st, 0) != 0) return;
+            if (synced(src, st)) {
+                stats.add(Counter::FilesSkipped);
+                // the siblings may not be, when --compress is new or one was removed
+                if (_compressor) compress(src, src2dst(src));
+            } else if (!(_inodes && linkSeen(src, st)) && !copyFile(src)) {
+                failed++;
+                return;
+            }
+            _manifest->record(src, st);
+            return;
+        }
+        if (_inodes) {
+            struct stat st;
+            stats.sys(Sys::Stat);
+            if (fstatat(e.dirfd, e.name, &st, 0) == 0 && linkSeen(src, st)) return;
+        }
+        if (uring) {
+            size_t f = 0;
+            bool queued = queueSmall(e, src, f);
+            failed += f;
+            if (queued) return;
+        }
+        if (!copyFile(src)) failed++;
+    });
+    scan.stop();
+    if (!_batch.empty()) failed += runBatch(_batch);
+    _batch.clear();
+    for (auto &[src, first] : _links) {
+        // the first copy failed (or the filesystem has no hardlinks), copy this one on its own
+        if (linkFile(src, first) || copyFile(src)) continue;
+        if (_manifest) _manifest->forget(src);
+        failed++;
+    }
+    _links.clear();
+    _inodes.reset();
+    failed += finishClean();
+    if (_compressor) failed += _compressor->wait();
+    saveManifest();
+    if (_opts.skipIdentical && _opts.verbose) log("Skipped " + to_string(_identical.exchange(0)) + " identical file(s)");
+    return failed;
+}
+
+// Whether the manifest has the source unchanged and its copy is still there, a removed or resized copy is made again
+bool Cpx::synced(const string &src, const struct stat &st) {
+    // --clean removes the copies while the walk runs, every one of them is made again
+    if (_opts.clean || !_manifest->unchanged(src, st)) return false;
+    struct stat dt;
+    stats.sys(Sys::Stat);
+    if (stat(src2dst(src).c_str(), &dt) != 0) return false;
+    // transformed copies have sizes of their own
+    return _transformer || _plugins || dt.st_size == st.st_size;
+}
+
+// Walks first and then runs the plan from a single thread, in the order the disk reads the sources fastest
+size_t Cpx::copyPlanned() {
+    size_t failed = 0;
+    // a dry run lists what the cleaner would remove up front, a real one overlaps it with the walk as usual
+    if (_opts.clean && !_cleaned) startClean();
+    if (_opts.dryRun) failed += finishClean();
+    WalkOpts wo = walkOpts();
+    Plan plan;
+    PhaseTimer scan(Phase::Scan);
+    walk(_base, wo, [this, &plan](const WalkEntry &e) {
+        string src(e.path);
+        stats.add(Counter::EntriesMatched);
+        if (e.type == DT_DIR) {
+            plan.add(PlanStep{PlanOp::MakeDir, "", src2dst(src)});
+            return;
+        }
+        struct stat st;
+        stats.sys(Sys::Stat);
+        if (fstatat(e.dirfd, e.name, &st, 0) != 0) return;
+        if (_manifest && synced(src, st)) {
+            stats.add(Counter::FilesSkipped);
+            if (_opts.dryRun) return;
+            _manifest->record(src, st);
+            if (_compressor) compress(src, src2dst(src));
+            return;
+        }
+        uint32_t first;
+        if (_inodes && S_ISREG(st.st_mode) && !_inodes->insert(st, _paths.intern(src), first)) {
+            plan.add(PlanStep{PlanOp::Link, src, src2dst(src), 0, 0, first});
+            return;
+        }
+        uint64_t offset = _opts.order == PlanOrder::Extent ? physicalOffset(e.dirfd, e.name) : 0;
+        plan.add(PlanStep{PlanOp::Copy, src, src2dst(src), offset, st.st_ino});
+    });
+    plan.finish(_opts.order, _outDir);
+    scan.stop();
+
+    string path;
+    for (const PlanStep &s : plan.steps()) {
+        string first = s.op == PlanOp::Link ? src2dst(_paths.path(s.first, path)) : "";
+        if (_opts.dryRun) {
+            if (s.op == PlanOp::MakeDir) log("mkdir " + s.dst);
+            else if (s.op == PlanOp::Copy) log("copy " + s.src + " --> " + s.dst);
+            else log("link " + s.src + " --> " + s.dst + " (" + first + ")");
+            if (s.op != PlanOp::MakeDir && _compressor && Compressor::compressible(s.dst)) {
+                string siblings;
+                for (const string &suffix : _compressor->suffixes()) {
+                    siblings += " " + s.dst + suffix;
+                }
+                log("compress " + s.dst + " -->" + siblings);
+            }
+            continue;
+        }
+        if (s.op == PlanOp::MakeDir) {
+            try {
+                claim(s.dst, true);
+                mkdirs(s.dst);
+                lock_guard<mutex> lock(_dirsMtx);
+                _dirs.insert(s.dst);
+            } catch (const exception &ex) {
+                log(ex.what(), true);
+                failed++;
+            }
+            continue;
+        }
+        // the first copy failed (or the filesystem has no hardlinks), copy this one on its own
+        bool ok = (s.op == PlanOp::Link && linkFile(s.src, first)) || copyFile(s.src);
+        if (!ok) failed++;
+        struct stat st;
+        if (ok && _manifest && stat(s.src.c_str(), &st) == 0) _manifest->record(s.src, st);
+    }
+    _inodes.reset();
+    if (_opts.dryRun) return failed;
+    failed += finishClean();
+    if (_compressor) failed += _compressor->wait();
+    saveManifest();
+    if (_opts.skipIdentical && _opts.verbose) log("Skipped " + to_string(_identical.exchange(0)) + " identical file(s)");
+    return failed;
+}
+
+void Cpx::watch() {
+    watch(vector<Cpx *>{this});
+}
+
+// Watch roots, leaving out the ones inside another root: a directory is watched once and its events go to every job
+static vector<string> watchRoots(const vector<string> &bases) {
+    vector<string> roots;
+    for (string r : bases) {
+        while (r.substr(0, 2) == "./") r.erase(0, 2);
+        while (r.size() > 1 && r.back() == '/') r.pop_back();
+        roots.push_back(r.empty() ? "." : r);
+    }
+    sort(roots.begin(), roots.end());
+    roots.erase(unique(roots.begin(), roots.end()), roots.end());
+    bool all = find(roots.begin(), roots.end(), ".") != roots.end();
+    vector<string> top;
+    for (const string &r : roots) {
+        if (all && r != "." && r[0] != '/') continue;
+        if (!top.empty() && top.back() != "." && r.compare(0, top.back().size() + 1, top.back() + "/") == 0) continue;
+        top.push_back(r);
+    }
+    return top;
+}
+
+sigset_t Cpx::blockSignals() {
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+    return sigs;
+}
+
+void Cpx::watch(const vector<Cpx *> &all) {
+    // without an initial copy nothing has cleaned the destination yet
+    for (Cpx *c : all) {
+        if (!c->_opts.clean || c->_cleaned) continue;
+        c->startClean();
+        c->finishClean();
+    }
+    // main() blocked them already, the threads started since then don't take them either
+    sigset_t sigs = blockSignals();
+
+    // declared before the watchers, whose listeners submit to it
+    CopyScheduler scheduler([&all](const CopyJob &job, const atomic<bool> &cancel) { all[job.owner]->runJob(job, cancel); });
+    // jobs with and without -L can't share inotify watches, they see different trees
+    unique_ptr<FSWatcher> watchers[2];
+    function<bool(string_view)> dirFilters[2];
+    for (int follow = 0; follow < 2; follow++) {
+        vector<uint32_t> jobs;
+        vector<string> bases;
+        bool poll = false;
+        for (uint32_t i = 0; i < all.size(); i++) {
+            if (all[i]->_opts.dereference != (follow == 1)) continue;
+            jobs.push_back(i);
+            bases.push_back(all[i]->_base);
+            poll = poll || all[i]->_opts.poll;
+        }
+        if (jobs.empty()) continue;
+        dirFilters[follow] = [&all, jobs](string_view dir) {
+            for (uint32_t i : jobs) {
+                if (all[i]->_glob.couldMatchBelow(dir)) return true;
+            }
+            return false;
+        };
+        ChokidarOpts co;
+        co.ignoreInitial = true;
+        co.followSymlinks = follow == 1;
+        co.dirFilter = &dirFilters[follow];
+        // roots on network, FUSE and overlay filesystems are polled either way
+        co.usePolling = poll;
+        watchers[follow] = make_unique<FSWatcher>(co);
+        watchers[follow]->on([&all, &scheduler, jobs](WatchEvent ev, string_view path) {
+            if (ev == WatchEvent::Error) {
+                all[jobs[0]]->log("Watch error: " + string(path), true);
+                return;
+            }
+            for (uint32_t i : jobs) {
+                Cpx *c = all[i];
+                // a removed directory matters when anything below it could have been copied
+                bool dir = ev == WatchEvent::UnlinkDir;
+                if (!c->_glob.match(path) && !(dir && c->_glob.couldMatchBelow(path))) continue;
+                JobKind kind;
+                switch (ev) {
+                    case WatchEvent::Add:
+                    case WatchEvent::Change: kind = JobKind::Copy; break;
+                    case WatchEvent::AddDir:
+                        if (!c->_opts.includeEmptyDirs) continue;
+                        kind = JobKind::MakeDir;
+                        break;
+                    case WatchEvent::Unlink: kind = JobKind::Remove; break;
+                    case WatchEvent::UnlinkDir: kind = JobKind::RemoveDir; break;
+                    default: continue;
+                }
+                scheduler.submit(c->src2dst(path), CopyJob{kind, string(path), i});
+            }
+        });
+        for (const string &root : watchRoots(bases)) {
+            watchers[follow]->add(root);
+        }
+    }
+    for (Cpx *c : all) {
+        if (c->_opts.verbose) c->log("Be watching " + c->_source);
+    }
+    int sig;
+    // SIGUSR1 dumps the stats so far, a watching cpx never gets to print them on exit otherwise
+    while (sigwait(&sigs, &sig) == 0 && sig == SIGUSR1) {
+        if (stats.enabled) logger.write(LogStream::Err, stats.toJson());
+    }
+    for (auto &w : watchers) {
+        if (w) w->close();
+    }
+    scheduler.close();
+    for (Cpx *c : all) {
+        c->saveManifest();
+    }
+}
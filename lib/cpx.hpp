@@ -0,0 +1,126 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <csignal>
+#include <optional>
+#include <functional>
+#include <unordered_set>
+#include <string_view>
+#include "copy.hpp"
+#include "walk.hpp"
+#include "clean.hpp"
+#include "compress.hpp"
+#include "inodes.hpp"
+#include "uring.hpp"
+#include "scheduler.hpp"
+#include "plan.hpp"
+#include "paths.hpp"
+#include "plugin.hpp"
+#include "manifest.hpp"
+#include "stats.hpp"
+#include "transform.hpp"
+#include "../pkgs/co/picomatch.hpp"
+
+class CpxOpts {
+public:
+    bool clean = false;
+    bool dereference = false;
+    bool includeEmptyDirs = false;
+    bool initial = true;
+    bool preserve = false;
+    bool update = false;
+    bool verbose = false;
+    bool watch = false;
+    // Poll the watched trees with statx even where inotify works
+    bool poll = false;
+    bool uring = false;
+    bool skipIdentical = false;
+    // Print the plan of the initial copy instead of running it
+    bool dryRun = false;
+    // Anything but Walk plans the initial copy and runs it in that order, instead of copying during the walk
+    PlanOrder order = PlanOrder::Walk;
+    // Size from which single files are copied in parallel ranges, 0 for never
+    off_t parallelThreshold = 64 << 20;
+    std::vector<std::string> commands;
+    std::vector<std::string> transforms;
+    std::vector<std::string> ignoreFiles;
+    // Formats to write precompressed siblings of web assets in, like "gz,br"
+    std::vector<std::string> compress;
+};
+
+/*
+ * Port of the Cpx class of https://github.com/mysticatea/cpx
+ * The original code was licensed under the MIT License -> https://github.com/mysticatea/cpx/blob/master/LICENSE
+ */
+class Cpx {
+public:
+    // `sources` are globs, the ones starting with '!' exclude what they match
+    Cpx(const std::vector<std::string> &sources, const std::string &outDir, CpxOpts opts);
+
+    // Copies every file matching the source glob, returns the number of files that failed
+    size_t copy();
+    // Copies files as they change until SIGINT/SIGTERM
+    void watch();
+    // Same for many instances at once, sharing the watches of directories they have in common and one worker pool
+    static void watch(const std::vector<Cpx *> &all);
+    // Blocks SIGINT, SIGTERM and SIGUSR1 in the calling thread and returns them. Call it before any Cpx, worker or log
+    // thread exists, those inherit the mask and so leave the signals to the sigwait of watch()
+    static sigset_t blockSignals();
+    std::string src2dst(std::string_view path) const;
+
+private:
+    std::string _source;
+    std::string _outDir;
+    std::string _base;
+    CpxOpts _opts;
+    PicomatchSet _glob;
+    CopyEngine _engine;
+    // Source paths the manifest and the -L inode set refer to by id
+    PathStore _paths;
+    std::unique_ptr<Manifest> _manifest;
+    std::unique_ptr<Transformer> _transformer;
+    std::unique_ptr<PluginChain> _plugins;
+    std::unique_ptr<Cleaner> _cleaner;
+    std::unique_ptr<Compressor> _compressor;
+    std::function<void(const std::string &, const std::string &)> _onCompressed;
+    std::function<void(const std::string &, const std::string &)> _onCompressError;
+    bool _cleaned = false;
+    std::chrono::steady_clock::time_point _cleanStart;
+    std::atomic<size_t> _cleanErrors{0};
+    std::function<void(std::string_view, int)> _onCleanError;
+    std::function<void(std::string_view, bool)> _onCleanRemove;
+    mode_t _umask;
+    std::atomic<size_t> _identical{0};
+    std::mutex _batchMtx;
+    std::vector<UringJob> _batch;
+    std::mutex _dirsMtx;
+    std::unordered_set<std::string> _dirs;
+    std::unique_ptr<InodeSet> _inodes;
+    std::mutex _linksMtx;
+    std::vector<std::pair<std::string, std::string>> _links;
+    std::function<void(std::string_view, int)> _onWalkError;
+
+    void startClean();
+    size_t finishClean();
+    size_t copyPlanned();
+    WalkOpts walkOpts();
+    void claim(const std::string &dst, bool dir = false);
+    // Empty when the copy failed, which is logged
+    std::optional<CopyStatus> copyFile(const std::string &src, const std::atomic<bool> *cancel = nullptr);
+    void compress(const std::string &src, const std::string &dst);
+    bool linkSeen(const std::string &src, const struct stat &st);
+    bool synced(const std::string &src, const struct stat &st);
+    bool linkFile(const std::string &src, const std::string &first);
+    void removeFile(const std::string &src, bool dir);
+    void removeBelow(const std::string &src, const std::string &dst);
+    void runJob(const CopyJob &job, const std::atomic<bool> &cancel);
+    bool queueSmall(const WalkEntry &e, const std::string &src, size_t &failed);
+    size_t runBatch(std::vector<UringJob> &jobs);
+    void ensureDir(const std::string &dst);
+    void saveManifest();
+    void log(const std::string &line, bool err = false);
+};
@@ -0,0 +1,43 @@
+#ifndef CPX_PLUGIN_H
+#define CPX_PLUGIN_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * C ABI of `-t/--transform` plugins: shared objects loaded with dlopen that transform file contents inside cpx.
+ *
+ * For every file cpx calls cpx_init, then cpx_transform with the source in chunks, then cpx_finish. Files are
+ * transformed concurrently on cpx's worker threads, each with its own context, so anything shared between them must be
+ * thread safe. Plugins given several times run as a chain, each one's output is the next one's input.
+ */
+
+#define CPX_PLUGIN_ABI 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Starts a file. `abi` is CPX_PLUGIN_ABI, `src` and `dst` the paths of the file. `*ctx` may be set to anything, it is
+ * passed to the other calls. Returns 0 or an errno value, in which case cpx_finish is not called.
+ */
+int cpx_init(uint32_t abi, const char *src, const char *dst, void **ctx);
+
+/*
+ * Transforms the next chunk `in[0..in_len)` into `out[0..out_cap)`, both buffers belong to cpx and are only valid
+ * during the call. Sets `*consumed` to the input bytes used and `*produced` to the output bytes written. Input that
+ * was not consumed is passed again in the next call, so every call has to consume or produce something; output that
+ * doesn't fit has to be kept until a later call. `in_len` is 0 only at the end of the file, that call is repeated
+ * until it produces nothing to flush what is left. Returns 0 or an errno value.
+ */
+int cpx_transform(void *ctx, const unsigned char *in, size_t in_len, size_t *consumed, unsigned char *out,
+                  size_t out_cap, size_t *produced);
+
+/* Ends a file, also after an error. Returns 0 or an errno value. */
+int cpx_finish(void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
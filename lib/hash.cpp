@@ -0,0 +1,256 @@
+#include <mutex>
+#include <cerrno>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/stat.h>
+#include "hash.hpp"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+const uint64_t P32_1 = 0x9E3779B1u;
+const uint64_t P32_2 = 0x85EBCA77u;
+const uint64_t P32_3 = 0xC2B2AE3Du;
+const uint64_t P64_1 = 0x9E3779B185EBCA87ull;
+const uint64_t P64_2 = 0xC2B2AE3D27D4EB4Full;
+const uint64_t P64_3 = 0x165667B19E3779F9ull;
+const uint64_t P64_4 = 0x85EBCA77C2B2AE63ull;
+const uint64_t P64_5 = 0x27D4EB2F165667C5ull;
+const size_t STRIPE = 64;
+const size_t STRIPES_PER_BLOCK = 16;
+const size_t BLOCK = STRIPE * STRIPES_PER_BLOCK;
+// files are hashed in reads of this many bytes, a multiple of BLOCK
+const size_t READ_SIZE = 1024 * BLOCK;
+// entries kept per shard of a HashCache, the least recently used ones go first
+const size_t SHARD_ENTRIES = 4096;
+
+alignas(64) const uint64_t KEY[8] = {
+    0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+    0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull,
+};
+
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t fold(uint64_t a, uint64_t b) {
+    __uint128_t m = (__uint128_t)a * b;
+    return (uint64_t)m ^ (uint64_t)(m >> 64);
+}
+
+static inline uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ull;
+    return h ^ (h >> 32);
+}
+
+// Every lane: acc += swapped neighbour + lo32(d ^ key) * hi32(d ^ key), the same maths in all three versions
+[[maybe_unused]] static void accumulateScalar(uint64_t *acc, const unsigned char *p, size_t stripes) {
+    for (size_t s = 0; s < stripes; s++, p += STRIPE) {
+        for (int i = 0; i < 8; i++) {
+            uint64_t d = read64(p + i * 8);
+            uint64_t x = d ^ KEY[i];
+            acc[i ^ 1] += d;
+            acc[i] += (x & 0xffffffff) * (x >> 32);
+        }
+    }
+}
+
+#if defined(__x86_64__)
+static void accumulateSse2(uint64_t *acc, const unsigned char *p, size_t stripes) {
+    __m128i a[4];
+    for (int i = 0; i < 4; i++) a[i] = _mm_loadu_si128((const __m128i *)acc + i);
+    for (size_t s = 0; s < stripes; s++, p += STRIPE) {
+        for (int i = 0; i < 4; i++) {
+            __m128i d = _mm_loadu_si128((const __m128i *)p + i);
+            __m128i x = _mm_xor_si128(d, _mm_load_si128((const __m128i *)KEY + i));
+            __m128i prod = _mm_mul_epu32(x, _mm_srli_epi64(x, 32));
+            __m128i swap = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+            a[i] = _mm_add_epi64(a[i], _mm_add_epi64(prod, swap));
+        }
+    }
+    for (int i = 0; i < 4; i++) _mm_storeu_si128((__m128i *)acc + i, a[i]);
+}
+
+__attribute__((target("avx2"))) static void accumulateAvx2(uint64_t *acc, const unsigned char *p, size_t stripes) {
+    __m256i a0 = _mm256_loadu_si256((const __m256i *)acc);
+    __m256i a1 = _mm256_loadu_si256((const __m256i *)acc + 1);
+    __m256i k0 = _mm256_load_si256((const __m256i *)KEY);
+    __m256i k1 = _mm256_load_si256((const __m256i *)KEY + 1);
+    for (size_t s = 0; s < stripes; s++, p += STRIPE) {
+        __m256i d0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i d1 = _mm256_loadu_si256((const __m256i *)p + 1);
+        __m256i x0 = _mm256_xor_si256(d0, k0);
+        __m256i x1 = _mm256_xor_si256(d1, k1);
+        __m256i p0 = _mm256_mul_epu32(x0, _mm256_srli_epi64(x0, 32));
+        __m256i p1 = _mm256_mul_epu32(x1, _mm256_srli_epi64(x1, 32));
+        a0 = _mm256_add_epi64(a0, _mm256_add_epi64(p0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2))));
+        a1 = _mm256_add_epi64(a1, _mm256_add_epi64(p1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+    _mm256_storeu_si256((__m256i *)acc, a0);
+    _mm256_storeu_si256((__m256i *)acc + 1, a1);
+}
+#endif
+
+using accumulate_t = void (*)(uint64_t *, const unsigned char *, size_t);
+
+static accumulate_t pickAccumulate() {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) return accumulateAvx2;
+    return accumulateSse2;
+#else
+    return accumulateScalar;
+#endif
+}
+
+static uint64_t finish(uint64_t *acc, const unsigned char *p, size_t rest, size_t len);
+
+static void scramble(uint64_t *acc) {
+    for (int i = 0; i < 8; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= KEY[i];
+        acc[i] = a * P32_1;
+    }
+}
+
+uint64_t hash64(const void *data, size_t len) {
+    static const accumulate_t accumulate = pickAccumulate();
+    const unsigned char *p = (const unsigned char *)data;
+    if (len <= STRIPE) {
+        uint64_t h = len * P64_1 ^ KEY[0];
+        size_t i = 0;
+        for (; i + 8 <= len; i += 8) {
+            h = fold(h ^ read64(p + i), P64_2 ^ KEY[(i / 8) & 7]);
+        }
+        uint64_t tail = 0;
+        for (size_t k = 0; i + k < len; k++) {
+            tail |= (uint64_t)p[i + k] << (8 * k);
+        }
+        h = fold(h ^ tail, P64_3);
+        return avalanche(h);
+    }
+
+    uint64_t acc[8] = {P32_3, P64_1, P64_2, P64_3, P64_4, P32_2, P64_5, P32_1};
+    size_t blocks = (len - 1) / BLOCK;
+    for (size_t b = 0; b < blocks; b++) {
+        accumulate(acc, p + b * BLOCK, STRIPES_PER_BLOCK);
+        scramble(acc);
+    }
+    return finish(acc, p + blocks * BLOCK, len - blocks * BLOCK, len);
+}
+
+// The rest after the full blocks, `rest` bytes at `p` with at least STRIPE bytes of the input readable before `p`
+// when `rest` is less than that
+static uint64_t finish(uint64_t *acc, const unsigned char *p, size_t rest, size_t len) {
+    static const accumulate_t accumulate = pickAccumulate();
+    accumulate(acc, p, (rest - 1) / STRIPE);
+    // the last (possibly overlapping) stripe covers the tail
+    accumulate(acc, p + rest - STRIPE, 1);
+    uint64_t h = len * P64_1;
+    for (int i = 0; i < 4; i++) {
+        h += fold(acc[2 * i] ^ KEY[2 * i], acc[2 * i + 1] ^ KEY[2 * i + 1]);
+    }
+    return avalanche(h);
+}
+
+// Reads exactly `n` bytes at `off`, a file that got shorter fails
+static bool readAt(int fd, unsigned char *p, size_t n, off_t off) {
+    while (n > 0) {
+        ssize_t r = pread(fd, p, n, off);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        n -= r;
+        off += r;
+    }
+    return true;
+}
+
+// Reads with pread rather than mapping the file, a file truncated meanwhile is then a short read and not a SIGBUS
+bool hashFile(int fd, size_t size, uint64_t &out) {
+    static const accumulate_t accumulate = pickAccumulate();
+    // the last STRIPE bytes of the previous read stay in front of the next one, for the overlapping last stripe
+    thread_local vector<unsigned char> buf(STRIPE + READ_SIZE);
+    unsigned char *p = buf.data() + STRIPE;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (size <= READ_SIZE) {
+        if (!readAt(fd, p, size, 0)) return false;
+        out = hash64(p, size);
+        return true;
+    }
+    uint64_t acc[8] = {P32_3, P64_1, P64_2, P64_3, P64_4, P32_2, P64_5, P32_1};
+    size_t blocks = (size - 1) / BLOCK;
+    size_t off = 0;
+    for (size_t b = 0; b < blocks;) {
+        size_t n = min(READ_SIZE / BLOCK, blocks - b);
+        if (!readAt(fd, p, n * BLOCK, off)) return false;
+        for (size_t i = 0; i < n; i++) {
+            accumulate(acc, p + i * BLOCK, STRIPES_PER_BLOCK);
+            scramble(acc);
+        }
+        memcpy(buf.data(), p + n * BLOCK - STRIPE, STRIPE);
+        b += n;
+        off += n * BLOCK;
+    }
+    size_t rest = size - off;
+    if (!readAt(fd, p, rest, off)) return false;
+    out = finish(acc, p, rest, size);
+    return true;
+}
+
+HashCache::Key HashCache::keyOf(const struct stat &st) {
+    return Key{st.st_dev, st.st_ino, (uint64_t)st.st_size, (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec};
+}
+
+size_t HashCache::KeyHash::operator()(const Key &k) const {
+    return fold(k.dev ^ k.ino * P64_1, k.size ^ (uint64_t)k.mtime * P64_2);
+}
+
+bool HashCache::get(int fd, const struct stat &st, uint64_t &out) {
+    Key key = keyOf(st);
+    Shard &shard = _shards[KeyHash()(key) % _shards.size()];
+    {
+        lock_guard<mutex> lock(shard.mtx);
+        auto it = shard.map.find(key);
+        if (it != shard.map.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            out = it->second->second;
+            return true;
+        }
+    }
+    if (!hashFile(fd, st.st_size, out)) return false;
+    lock_guard<mutex> lock(shard.mtx);
+    insert(shard, key, out);
+    return true;
+}
+
+void HashCache::put(const struct stat &st, uint64_t hash) {
+    Key key = keyOf(st);
+    Shard &shard = _shards[KeyHash()(key) % _shards.size()];
+    lock_guard<mutex> lock(shard.mtx);
+    insert(shard, key, hash);
+}
+
+void HashCache::insert(Shard &shard, const Key &key, uint64_t hash) {
+    auto it = shard.map.find(key);
+    if (it != shard.map.end()) {
+        it->second->second = hash;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return;
+    }
+    shard.lru.emplace_front(key, hash);
+    shard.map[key] = shard.lru.begin();
+    if (shard.map.size() > SHARD_ENTRIES) {
+        shard.map.erase(shard.lru.back().first);
+        shard.lru.pop_back();
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <list>
+#include <mutex>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <sys/stat.h>
+#include <unordered_map>
+
+// 64-bit non-cryptographic hash in the style of XXH3 (not compatible with it), vectorized with SSE2/AVX2
+uint64_t hash64(const void *data, size_t len);
+// Hashes the whole file behind `fd`, returns false if it can't be read
+bool hashFile(int fd, size_t size, uint64_t &out);
+
+/*
+ * File hashes keyed by (dev, inode, size, mtime), so a file is only read again once it changed. The cache holds a
+ * bounded number of them and forgets the least recently used first.
+ */
+class HashCache {
+public:
+    bool get(int fd, const struct stat &st, uint64_t &out);
+    void put(const struct stat &st, uint64_t hash);
+
+private:
+    struct Key {
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t size;
+        int64_t mtime;
+        bool operator==(const Key &o) const = default;
+    };
+    struct KeyHash {
+        size_t operator()(const Key &k) const;
+    };
+    struct Shard {
+        std::mutex mtx;
+        // Most recently used first
+        std::list<std::pair<Key, uint64_t>> lru;
+        std::unordered_map<Key, std::list<std::pair<Key, uint64_t>>::iterator, KeyHash> map;
+    };
+    std::array<Shard, 16> _shards;
+
+    static Key keyOf(const struct stat &st);
+    static void insert(Shard &shard, const Key &key, uint64_t hash);
+};
@@ -0,0 +1,20 @@
+#include <mutex>
+#include <cstdint>
+#include <sys/stat.h>
+#include "inodes.hpp"
+
+using namespace std;
+
+size_t InodeSet::KeyHash::operator()(const Key &k) const {
+    uint64_t h = (k.ino ^ k.dev << 48) * 0x9E3779B97F4A7C15ull;
+    return h ^ h >> 29;
+}
+
+bool InodeSet::insert(const struct stat &st, uint32_t path, uint32_t &first) {
+    Key key{st.st_dev, st.st_ino};
+    Shard &shard = _shards[KeyHash()(key) % _shards.size()];
+    lock_guard<mutex> lock(shard.mtx);
+    auto [it, added] = shard.map.try_emplace(key, path);
+    if (!added) first = it->second;
+    return added;
+}
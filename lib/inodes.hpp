@@ -0,0 +1,33 @@
+#pragma once
+#include <mutex>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <sys/stat.h>
+#include <unordered_map>
+
+/*
+ * Files seen during one copy keyed by (dev, inode), each with the id of the path it was first seen at in the caller's
+ * PathStore. With -L the same file is usually reachable through many links, later occurrences become hardlinks to the
+ * first copy.
+ */
+class InodeSet {
+public:
+    // Adds the file and returns true, or returns false and sets `first` if it has been seen before
+    bool insert(const struct stat &st, uint32_t path, uint32_t &first);
+
+private:
+    struct Key {
+        uint64_t dev;
+        uint64_t ino;
+        bool operator==(const Key &o) const = default;
+    };
+    struct KeyHash {
+        size_t operator()(const Key &k) const;
+    };
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<Key, uint32_t, KeyHash> map;
+    };
+    std::array<Shard, 16> _shards;
+};
@@ -0,0 +1,225 @@
+#include <mutex>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <unistd.h>
+#include <stdexcept>
+#include "log.hpp"
+
+using namespace std;
+
+Logger logger;
+
+// Every record is a 32-bit header, the stream in the top bit and the length below it, and the line with its newline
+const uint32_t ERR_BIT = 1u << 31;
+
+static atomic<uint64_t> nextLoggerId{1};
+
+// The ring of the current thread, marked orphaned when the thread exits
+struct LocalRing {
+    uint64_t owner = 0;
+    shared_ptr<LogRing> ring;
+    ~LocalRing() {
+        if (ring) ring->orphaned.store(true, memory_order_release);
+    }
+};
+
+static void put(LogRing &r, uint64_t pos, const void *data, size_t n) {
+    size_t off = pos & (r.buf.size() - 1);
+    size_t first = min(n, r.buf.size() - off);
+    memcpy(r.buf.data() + off, data, first);
+    memcpy(r.buf.data(), (const char *)data + first, n - first);
+}
+
+static void get(const LogRing &r, uint64_t pos, void *data, size_t n) {
+    size_t off = pos & (r.buf.size() - 1);
+    size_t first = min(n, r.buf.size() - off);
+    memcpy(data, r.buf.data() + off, first);
+    memcpy((char *)data + first, r.buf.data(), n - first);
+}
+
+Logger::Logger(size_t ringSize, int outFd, int errFd) : _id(nextLoggerId++), _ringSize(ringSize), _fds{outFd, errFd} {
+    if (ringSize < 64 || (ringSize & (ringSize - 1)) != 0) throw runtime_error("Log ring size must be a power of two");
+}
+
+Logger::~Logger() {
+    close();
+}
+
+LogRing *Logger::ring() {
+    thread_local LocalRing local;
+    if (local.owner == _id) return local.ring.get();
+    lock_guard<mutex> lock(_mtx);
+    if (_closed) return nullptr;
+    if (local.ring) local.ring->orphaned.store(true, memory_order_release);
+    local.ring = make_shared<LogRing>(_ringSize);
+    local.owner = _id;
+    _rings.push_back(local.ring);
+    if (!_started) {
+        _started = true;
+        _thread = thread(&Logger::drain, this);
+    }
+    return local.ring.get();
+}
+
+void Logger::write(LogStream to, string_view line, bool droppable) {
+    size_t need = sizeof(uint32_t) + line.size() + 1;
+    LogRing *r = need <= _ringSize / 2 ? ring() : nullptr;
+    if (r == nullptr) {
+        // too long for the ring, or the drain thread is gone: write it directly once everything before it is out
+        flush();
+        writeDirect(to, line);
+        return;
+    }
+    uint64_t head = r->head.load(memory_order_relaxed);
+    for (unsigned spins = 0; head + need - r->tail.load(memory_order_acquire) > _ringSize; spins++) {
+        // the drain thread may be waiting for more lines to batch, the first line that doesn't fit hurries it up
+        if (droppable) {
+            if (_dropped.fetch_add(1, memory_order_relaxed) == 0) wake();
+            _droppedTotal.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        if (spins == 0) wake();
+        if (spins < 64) this_thread::yield();
+        else this_thread::sleep_for(chrono::microseconds(100));
+    }
+    uint32_t header = (uint32_t)(line.size() + 1) | (to == LogStream::Err ? ERR_BIT : 0);
+    put(*r, head, &header, sizeof(header));
+    put(*r, head + sizeof(header), line.data(), line.size());
+    put(*r, head + need - 1, "\n", 1);
+    r->head.store(head + need, memory_order_release);
+    // pairs with the fence in drain(), either it sees the new head or this sees it sleeping
+    atomic_thread_fence(memory_order_seq_cst);
+    if (_sleeping.load(memory_order_relaxed)) wake();
+}
+
+void Logger::wake() {
+    lock_guard<mutex> lock(_mtx);
+    _wake = true;
+    _cv.notify_one();
+}
+
+void Logger::flush() {
+    unique_lock<mutex> lock(_mtx);
+    if (!_started || _closed) return;
+    vector<pair<shared_ptr<LogRing>, uint64_t>> marks;
+    for (const shared_ptr<LogRing> &r : _rings) {
+        marks.emplace_back(r, r->head.load(memory_order_acquire));
+    }
+    _flushes++;
+    _cv.notify_one();
+    _flushed.wait(lock, [&marks]() {
+        for (auto &[r, head] : marks) {
+            if (r->done.load(memory_order_acquire) < head) return false;
+        }
+        return true;
+    });
+}
+
+void Logger::close() {
+    {
+        lock_guard<mutex> lock(_mtx);
+        if (_closed) return;
+        _closed = true;
+        _stopping = true;
+        _cv.notify_one();
+    }
+    if (_thread.joinable()) _thread.join();
+}
+
+void Logger::writeDirect(LogStream to, string_view line) {
+    string s(line);
+    s += '\n';
+    lock_guard<mutex> lock(_writeMtx);
+    writeAll(_fds[(size_t)to], s);
+}
+
+void Logger::writeAll(int fd, string_view data) {
+    while (!data.empty()) {
+        ssize_t n = ::write(fd, data.data(), data.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+        // nowhere left to report it
+        if (n <= 0) return;
+        data.remove_prefix(n);
+    }
+}
+
+void Logger::drain() {
+    vector<shared_ptr<LogRing>> rings;
+    vector<uint64_t> taken;
+    string bufs[2];
+    for (;;) {
+        bool stopping;
+        uint64_t flushes;
+        {
+            lock_guard<mutex> lock(_mtx);
+            rings = _rings;
+            stopping = _stopping;
+            flushes = _flushes;
+        }
+        taken.resize(rings.size());
+        for (size_t i = 0; i < rings.size(); i++) {
+            LogRing &r = *rings[i];
+            uint64_t head = r.head.load(memory_order_acquire);
+            for (uint64_t pos = r.tail.load(memory_order_relaxed); pos < head;) {
+                uint32_t header;
+                get(r, pos, &header, sizeof(header));
+                size_t len = header & ~ERR_BIT;
+                string &buf = bufs[(header & ERR_BIT) != 0];
+                size_t at = buf.size();
+                buf.resize(at + len);
+                get(r, pos + sizeof(header), buf.data() + at, len);
+                pos += sizeof(header) + len;
+            }
+            // the lines are copied out, the thread can reuse the room while they are written
+            r.tail.store(head, memory_order_release);
+            taken[i] = head;
+        }
+        uint64_t dropped = _dropped.exchange(0, memory_order_relaxed);
+        if (dropped > 0) {
+            bufs[1] += "Dropped " + to_string(dropped) + " line(s) of verbose output, it came faster than it could be written\n";
+        }
+        bool any = !bufs[0].empty() || !bufs[1].empty();
+        if (any) {
+            lock_guard<mutex> lock(_writeMtx);
+            writeAll(_fds[0], bufs[0]);
+            writeAll(_fds[1], bufs[1]);
+        }
+        bufs[0].clear();
+        bufs[1].clear();
+
+        unique_lock<mutex> lock(_mtx);
+        for (size_t i = 0; i < rings.size(); i++) {
+            rings[i]->done.store(taken[i], memory_order_release);
+        }
+        erase_if(_rings, [](const shared_ptr<LogRing> &r) {
+            return r->orphaned.load(memory_order_acquire) && r->done.load(memory_order_relaxed) == r->head.load(memory_order_relaxed);
+        });
+        _flushed.notify_all();
+        if (stopping && !any) return;
+        if (any) {
+            // a busy thread fills the next write meanwhile, a flush doesn't wait for it
+            _cv.wait_for(lock, chrono::milliseconds(1), [&]() { return _wake || _flushes != flushes || _stopping; });
+            _wake = false;
+            continue;
+        }
+        _sleeping.store(true);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool pending = _dropped.load(memory_order_relaxed) > 0;
+        for (const shared_ptr<LogRing> &r : _rings) {
+            pending = pending || r->head.load(memory_order_relaxed) != r->tail.load(memory_order_relaxed);
+        }
+        if (!pending) _cv.wait(lock, [&]() { return _wake || _flushes != flushes || _stopping; });
+        _wake = false;
+        _sleeping.store(false);
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+#include <condition_variable>
+
+enum class LogStream : uint8_t { Out, Err };
+
+// One thread's records, written by that thread only and read by the drain thread
+struct LogRing {
+    explicit LogRing(size_t size) : buf(size) {}
+    std::vector<char> buf;
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    // Up to where the records have been written out
+    std::atomic<uint64_t> done{0};
+    // Set when the thread exits, the ring goes away once it is drained
+    std::atomic<bool> orphaned{false};
+};
+
+/*
+ * Asynchronous line output. Every thread appends its lines to its own lock-free ring buffer and one drain thread
+ * collects them about once a millisecond and writes stdout and stderr in large writes, so logging a line is a copy
+ * and never a syscall or a lock. When a ring is full, droppable lines (verbose output) are counted and dropped and a
+ * note about them is written instead, everything else waits for room. Lines of one thread keep their order.
+ */
+class Logger {
+public:
+    // `ringSize` is per thread and a power of two
+    explicit Logger(size_t ringSize = 64 * 1024, int outFd = 1, int errFd = 2);
+    ~Logger();
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+
+    // Writes `line` and a newline
+    void write(LogStream to, std::string_view line, bool droppable = false);
+    // Returns once everything written so far is out
+    void flush();
+    // Flushes and stops the drain thread, lines written afterwards are written directly
+    void close();
+    uint64_t dropped() const { return _droppedTotal.load(std::memory_order_relaxed); }
+
+private:
+    const uint64_t _id;
+    const size_t _ringSize;
+    const int _fds[2];
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    std::condition_variable _flushed;
+    std::vector<std::shared_ptr<LogRing>> _rings;
+    std::thread _thread;
+    bool _started = false;
+    bool _closed = false;
+    bool _stopping = false;
+    bool _wake = false;
+    uint64_t _flushes = 0;
+    std::atomic<bool> _sleeping{false};
+    std::atomic<uint64_t> _dropped{0};
+    std::atomic<uint64_t> _droppedTotal{0};
+    // Held by whoever writes to the descriptors, the drain thread or a direct write
+    std::mutex _writeMtx;
+
+    LogRing *ring();
+    void wake();
+    void writeDirect(LogStream to, std::string_view line);
+    void drain();
+    void writeAll(int fd, std::string_view data);
+};
+
+extern Logger logger;
@@ -0,0 +1,155 @@
+#include <mutex>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string_view>
+#include "copy.hpp"
+#include "manifest.hpp"
+
+using namespace std;
+
+const char MAGIC[8] = {'C', 'P', 'X', 'M', 'A', 'N', 0, 0};
+const uint32_t VERSION = 2;
+
+static int64_t mtimeNs(const struct stat &st) {
+    return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+Manifest::Manifest(string file, PathStore *paths) : _file(file), _paths(paths) {
+    int fd = open(_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ManifestHeader)) {
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            _map = map;
+            _mapSize = st.st_size;
+        }
+    }
+    close(fd);
+    if (_map == nullptr) return;
+    const ManifestHeader *h = (const ManifestHeader *)_map;
+    size_t entriesEnd = sizeof(ManifestHeader) + (size_t)h->count * sizeof(ManifestEntry);
+    bool valid = memcmp(h->magic, MAGIC, sizeof(MAGIC)) == 0 && h->version == VERSION && entriesEnd <= _mapSize
+                 && h->strOff >= entriesEnd && h->strOff + h->strLen <= _mapSize;
+    if (!valid) return;
+    _header = h;
+    _entries = (const ManifestEntry *)((const char *)_map + sizeof(ManifestHeader));
+    _strs = (const char *)_map + h->strOff;
+}
+
+Manifest::~Manifest() {
+    if (_map != nullptr) munmap(_map, _mapSize);
+}
+
+const ManifestEntry *Manifest::find(string_view path) const {
+    if (_header == nullptr) return nullptr;
+    auto key = [this](const ManifestEntry &e) {
+        if (e.path + (uint64_t)e.pathLen > _header->strLen) return string_view();
+        return string_view(_strs + e.path, e.pathLen);
+    };
+    const ManifestEntry *end = _entries + _header->count;
+    const ManifestEntry *it = lower_bound(_entries, end, path, [&key](const ManifestEntry &e, string_view p) {
+        return key(e) < p;
+    });
+    if (it == end || key(*it) != path) return nullptr;
+    return it;
+}
+
+bool Manifest::unchanged(string_view path, const struct stat &st) const {
+    const ManifestEntry *e = find(path);
+    return e != nullptr && e->size == (uint64_t)st.st_size && e->mtime == mtimeNs(st) && e->ino == st.st_ino;
+}
+
+void Manifest::record(string_view path, const struct stat &st) {
+    ManifestEntry e{(uint64_t)st.st_size, mtimeNs(st), st.st_ino, 0, 1};
+    uint32_t id = _paths->intern(path);
+    lock_guard<mutex> lock(_mtx);
+    if (id >= _next.size()) _next.resize(id + 1);
+    _recorded += _next[id].pathLen == 0;
+    _next[id] = e;
+}
+
+void Manifest::forget(string_view path) {
+    uint32_t id = _paths->find(path);
+    lock_guard<mutex> lock(_mtx);
+    if (id >= _next.size() || _next[id].pathLen == 0) return;
+    _next[id].pathLen = 0;
+    _recorded--;
+}
+
+void Manifest::save() {
+    lock_guard<mutex> lock(_mtx);
+    // paths go into the string table in id order, then the entries are sorted by the strings they point at
+    string strs;
+    string path;
+    vector<ManifestEntry> entries;
+    entries.reserve(_recorded);
+    for (uint32_t id = 0; id < _next.size(); id++) {
+        if (_next[id].pathLen == 0) continue;
+        ManifestEntry out = _next[id];
+        _paths->path(id, path);
+        out.path = strs.size();
+        out.pathLen = path.size();
+        strs.append(path);
+        entries.push_back(out);
+    }
+    auto key = [&strs](const ManifestEntry &e) { return string_view(strs).substr(e.path, e.pathLen); };
+    sort(entries.begin(), entries.end(), [&key](auto &a, auto &b) { return key(a) < key(b); });
+
+    ManifestHeader h{};
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.count = entries.size();
+    h.strOff = sizeof(ManifestHeader) + entries.size() * sizeof(ManifestEntry);
+    h.strLen = strs.size();
+
+    size_t slash = _file.find_last_of('/');
+    if (slash != string::npos && slash > 0) mkdirs(_file.substr(0, slash));
+    string tmp = _file + ".tmp" + to_string(getpid());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) throw runtime_error("Cannot write " + tmp + ": " + strerror(errno));
+    bool ok = write(fd, &h, sizeof(h)) == sizeof(h);
+    ok = ok && write(fd, entries.data(), entries.size() * sizeof(ManifestEntry)) == (ssize_t)(entries.size() * sizeof(ManifestEntry));
+    ok = ok && write(fd, strs.data(), strs.size()) == (ssize_t)strs.size();
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), _file.c_str()) != 0) {
+        int err = errno;
+        unlink(tmp.c_str());
+        throw runtime_error("Cannot write " + _file + ": " + strerror(err));
+    }
+}
+
+string manifestPath(const string &source, const string &dest) {
+    string dir;
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (cache != nullptr && cache[0] != 0) dir = cache;
+    else if (home != nullptr && home[0] != 0) dir = string(home) + "/.cache";
+    else return "";
+
+    char cwd[PATH_MAX];
+    string key = getcwd(cwd, sizeof(cwd)) != nullptr ? cwd : "";
+    key += '\0';
+    key += source;
+    key += '\0';
+    key += dest;
+    // FNV-1a, only used to name the file
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : key) {
+        h = (h ^ c) * 0x100000001b3ull;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.manifest", (unsigned long long)h);
+    return dir + "/cpx/" + name;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/stat.h>
+#include <string_view>
+#include "paths.hpp"
+
+struct ManifestHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t strOff;
+    uint64_t strLen;
+};
+
+struct ManifestEntry {
+    uint64_t size;
+    int64_t mtime;
+    uint64_t ino;
+    uint32_t path;
+    uint32_t pathLen;
+};
+
+/*
+ * On-disk record of the source files cpx synced last time: a header, entries sorted by path and one string table.
+ * The previous manifest is mmap'ed as is and searched in place, the next one is collected in memory and written by
+ * save() through a rename, so a crash leaves the old manifest intact.
+ * It only vouches for the sources, cpx still checks that the copy of an unchanged source exists with its size.
+ * Entries of the next manifest are kept by path id in `paths`, which may be shared with the rest of the copy.
+ */
+class Manifest {
+public:
+    Manifest(std::string file, PathStore *paths);
+    ~Manifest();
+    Manifest(const Manifest &) = delete;
+    Manifest &operator=(const Manifest &) = delete;
+
+    const ManifestEntry *find(std::string_view path) const;
+    // Whether the source file was synced with exactly this size, mtime and inode
+    bool unchanged(std::string_view path, const struct stat &st) const;
+    void record(std::string_view path, const struct stat &st);
+    void forget(std::string_view path);
+    void save();
+
+private:
+    std::string _file;
+    void *_map = nullptr;
+    size_t _mapSize = 0;
+    const ManifestHeader *_header = nullptr;
+    const ManifestEntry *_entries = nullptr;
+    const char *_strs = nullptr;
+    PathStore *_paths;
+    std::mutex _mtx;
+    // Indexed by path id, pathLen is 1 for the paths recorded and 0 for the rest
+    std::vector<ManifestEntry> _next;
+    size_t _recorded = 0;
+};
+
+// Where the manifest for copying `source` to `dest` lives, empty if there is no cache directory
+std::string manifestPath(const std::string &source, const std::string &dest);
@@ -0,0 +1,149 @@
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <shared_mutex>
+#include "hash.hpp"
+#include "paths.hpp"
+
+using namespace std;
+
+static size_t childHash(uint32_t parent, uint32_t name) {
+    uint64_t h = ((uint64_t)parent << 32 | name) * 0x9E3779B97F4A7C15ull;
+    return h ^ h >> 31;
+}
+
+// Rehashes into a table twice the size once it is 3/4 full, `key` gives the hash of a stored value
+template <class F>
+static void reserveSlot(vector<uint32_t> &table, size_t used, F key) {
+    if ((used + 1) * 4 <= table.size() * 3) return;
+    vector<uint32_t> next(table.size() * 2, 0);
+    size_t mask = next.size() - 1;
+    for (uint32_t v : table) {
+        if (v == 0) continue;
+        size_t i = key(v) & mask;
+        while (next[i] != 0) i = (i + 1) & mask;
+        next[i] = v;
+    }
+    table.swap(next);
+}
+
+PathStore::PathStore() : _nameOffs{0}, _names(64, 0), _children(64, 0) {
+    _nodes.push_back(Node{NONE, NONE});
+}
+
+string_view PathStore::nameOf(uint32_t name) const {
+    return string_view(_chars).substr(_nameOffs[name], _nameOffs[name + 1] - _nameOffs[name]);
+}
+
+uint32_t PathStore::findName(string_view name) const {
+    size_t mask = _names.size() - 1;
+    for (size_t i = hash64(name.data(), name.size()) & mask; _names[i] != 0; i = (i + 1) & mask) {
+        if (nameOf(_names[i] - 1) == name) return _names[i] - 1;
+    }
+    return NONE;
+}
+
+uint32_t PathStore::findChild(uint32_t parent, uint32_t name) const {
+    size_t mask = _children.size() - 1;
+    for (size_t i = childHash(parent, name) & mask; _children[i] != 0; i = (i + 1) & mask) {
+        const Node &n = _nodes[_children[i]];
+        if (n.parent == parent && n.name == name) return _children[i];
+    }
+    return NONE;
+}
+
+uint32_t PathStore::addName(string_view name) {
+    if (_chars.size() + name.size() >= NONE || _nameOffs.size() >= NONE) throw runtime_error("Too many paths");
+    reserveSlot(_names, _nameOffs.size() - 1, [this](uint32_t v) {
+        string_view n = nameOf(v - 1);
+        return hash64(n.data(), n.size());
+    });
+    uint32_t id = _nameOffs.size() - 1;
+    _chars.append(name);
+    _nameOffs.push_back(_chars.size());
+    size_t mask = _names.size() - 1;
+    size_t i = hash64(name.data(), name.size()) & mask;
+    while (_names[i] != 0) i = (i + 1) & mask;
+    _names[i] = id + 1;
+    return id;
+}
+
+uint32_t PathStore::addChild(uint32_t parent, uint32_t name) {
+    if (_nodes.size() >= NONE) throw runtime_error("Too many paths");
+    reserveSlot(_children, _nodes.size() - 1, [this](uint32_t v) { return childHash(_nodes[v].parent, _nodes[v].name); });
+    uint32_t id = _nodes.size();
+    _nodes.push_back(Node{parent, name});
+    size_t mask = _children.size() - 1;
+    size_t i = childHash(parent, name) & mask;
+    while (_children[i] != 0) i = (i + 1) & mask;
+    _children[i] = id;
+    return id;
+}
+
+uint32_t PathStore::findLocked(string_view path) const {
+    uint32_t id = ROOT;
+    for (size_t pos = 0; !path.empty() && id != NONE;) {
+        size_t slash = path.find('/', pos);
+        uint32_t name = findName(path.substr(pos, slash == string_view::npos ? string_view::npos : slash - pos));
+        id = name == NONE ? NONE : findChild(id, name);
+        if (slash == string_view::npos) break;
+        pos = slash + 1;
+    }
+    return id;
+}
+
+uint32_t PathStore::find(string_view path) const {
+    shared_lock<shared_mutex> lock(_mtx);
+    return findLocked(path);
+}
+
+uint32_t PathStore::intern(string_view path) {
+    {
+        shared_lock<shared_mutex> lock(_mtx);
+        uint32_t id = findLocked(path);
+        if (id != NONE) return id;
+    }
+    unique_lock<shared_mutex> lock(_mtx);
+    uint32_t id = ROOT;
+    // empty components are names too ("/a", "a//b", "a/"), so every path comes back exactly as it went in
+    for (size_t pos = 0; !path.empty();) {
+        size_t slash = path.find('/', pos);
+        string_view part = path.substr(pos, slash == string_view::npos ? string_view::npos : slash - pos);
+        uint32_t name = findName(part);
+        if (name == NONE) name = addName(part);
+        uint32_t child = findChild(id, name);
+        id = child != NONE ? child : addChild(id, name);
+        if (slash == string_view::npos) break;
+        pos = slash + 1;
+    }
+    return id;
+}
+
+const string &PathStore::path(uint32_t id, string &out) const {
+    thread_local vector<uint32_t> chain;
+    chain.clear();
+    out.clear();
+    shared_lock<shared_mutex> lock(_mtx);
+    for (uint32_t n = id; n != ROOT; n = _nodes[n].parent) {
+        chain.push_back(n);
+    }
+    for (size_t i = chain.size(); i-- > 0;) {
+        out.append(nameOf(_nodes[chain[i]].name));
+        if (i > 0) out += '/';
+    }
+    return out;
+}
+
+size_t PathStore::size() const {
+    shared_lock<shared_mutex> lock(_mtx);
+    return _nodes.size();
+}
+
+size_t PathStore::bytes() const {
+    shared_lock<shared_mutex> lock(_mtx);
+    return _nodes.capacity() * sizeof(Node) + _chars.capacity() + (_nameOffs.capacity() + _names.capacity()
+           + _children.capacity()) * sizeof(uint32_t);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <shared_mutex>
+
+/*
+ * Interned paths addressed by 32-bit ids. Every path is a (parent id, name id) pair and every distinct file or
+ * directory name is stored once, so a tree costs about 8 bytes per entry, two hash slots and its distinct names
+ * instead of a full string per file. Paths are rebuilt from the parent chain on demand and round-trip exactly.
+ * Ids are never reused. Thread safe, lookups of known paths run in parallel.
+ */
+class PathStore {
+public:
+    static const uint32_t NONE = UINT32_MAX;
+    // Id of the empty path, the parent of all top level entries
+    static const uint32_t ROOT = 0;
+
+    PathStore();
+
+    uint32_t intern(std::string_view path);
+    uint32_t find(std::string_view path) const;
+    // Writes the path of `id` into `out` and returns it
+    const std::string &path(uint32_t id, std::string &out) const;
+    // Number of ids, the directories above interned paths included
+    size_t size() const;
+    // Heap bytes held
+    size_t bytes() const;
+
+private:
+    struct Node {
+        uint32_t parent;
+        uint32_t name;
+    };
+    mutable std::shared_mutex _mtx;
+    std::vector<Node> _nodes;
+    std::string _chars;
+    // Start of every name in _chars, followed by the end of the last one
+    std::vector<uint32_t> _nameOffs;
+    // Open addressing tables, power of two sized: name id + 1 and node id, 0 is a free slot in both
+    std::vector<uint32_t> _names;
+    std::vector<uint32_t> _children;
+
+    std::string_view nameOf(uint32_t name) const;
+    uint32_t findName(std::string_view name) const;
+    uint32_t findChild(uint32_t parent, uint32_t name) const;
+    uint32_t findLocked(std::string_view path) const;
+    uint32_t addName(std::string_view name);
+    uint32_t addChild(uint32_t parent, uint32_t name);
+};
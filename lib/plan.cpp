@@ -0,0 +1,61 @@
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <unordered_set>
+#include "plan.hpp"
+#include "stats.hpp"
+
+using namespace std;
+
+void Plan::add(PlanStep &&step) {
+    lock_guard<mutex> lock(_mtx);
+    _steps.push_back(move(step));
+}
+
+void Plan::finish(PlanOrder order, const string &root) {
+    lock_guard<mutex> lock(_mtx);
+    unordered_set<string> dirs;
+    for (const PlanStep &s : _steps) {
+        if (s.op == PlanOp::MakeDir) dirs.insert(s.dst);
+    }
+    size_t n = _steps.size();
+    for (size_t i = 0; i < n; i++) {
+        // every ancestor up to the root, so the copies never have to create one
+        string dir = _steps[i].dst;
+        for (size_t slash = dir.find_last_of('/'); slash != string::npos && slash > 0; slash = dir.find_last_of('/')) {
+            dir.resize(slash);
+            if (dir.size() <= root.size() || !dirs.insert(dir).second) break;
+            _steps.push_back(PlanStep{PlanOp::MakeDir, "", dir});
+        }
+    }
+    auto rank = [](const PlanStep &s) { return s.op == PlanOp::MakeDir ? 0 : s.op == PlanOp::Copy ? 1 : 2; };
+    stable_sort(_steps.begin(), _steps.end(), [order, &rank](const PlanStep &a, const PlanStep &b) {
+        if (rank(a) != rank(b)) return rank(a) < rank(b);
+        // "a" sorts before "a/b", which is all mkdir needs
+        if (a.op == PlanOp::MakeDir || order == PlanOrder::Walk) return a.op == PlanOp::MakeDir && a.dst < b.dst;
+        if (a.offset != b.offset) return a.offset < b.offset;
+        return a.ino < b.ino;
+    });
+}
+
+uint64_t physicalOffset(int dirfd, const char *name) {
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    stats.sys(Sys::Open);
+    if (fd < 0) return UINT64_MAX;
+    alignas(fiemap) char buf[sizeof(fiemap) + sizeof(fiemap_extent)] = {};
+    fiemap *fm = (fiemap *)buf;
+    fm->fm_length = FIEMAP_MAX_OFFSET;
+    fm->fm_extent_count = 1;
+    stats.sys(Sys::Fiemap);
+    int r = ioctl(fd, FS_IOC_FIEMAP, fm);
+    close(fd);
+    if (r != 0 || fm->fm_mapped_extents == 0) return UINT64_MAX;
+    return fm->fm_extents[0].fe_physical;
+}
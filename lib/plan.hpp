@@ -0,0 +1,41 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+enum class PlanOrder : uint8_t { Walk, Inode, Extent };
+enum class PlanOp : uint8_t { MakeDir, Copy, Link };
+
+struct PlanStep {
+    PlanOp op;
+    std::string src;
+    std::string dst;
+    // Where the source starts on disk with PlanOrder::Extent, UINT64_MAX if unknown
+    uint64_t offset = 0;
+    uint64_t ino = 0;
+    // For links, the path id of the source whose copy is linked to
+    uint32_t first = 0;
+};
+
+/*
+ * The operations of an initial copy collected during the walk, to be printed by --dry-run or run in an order chosen
+ * for throughput: every destination directory first, parents before children, then the copies sorted by where their
+ * sources are on disk so that spinning disks and network block devices read sequentially, and the hardlinks to those
+ * copies last.
+ */
+class Plan {
+public:
+    // Thread safe, called from the walker
+    void add(PlanStep &&step);
+    // Adds the missing parent directories of the destinations and sorts the steps, `root` is never created
+    void finish(PlanOrder order, const std::string &root);
+    const std::vector<PlanStep> &steps() const { return _steps; }
+
+private:
+    std::mutex _mtx;
+    std::vector<PlanStep> _steps;
+};
+
+// Physical offset of the first extent of a file from FIEMAP, UINT64_MAX for empty files and filesystems without it
+uint64_t physicalOffset(int dirfd, const char *name);
@@ -0,0 +1,132 @@
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <vector>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <cstring>
+#include <unistd.h>
+#include <optional>
+#include <stdexcept>
+#include <sys/stat.h>
+#include "copy.hpp"
+#include "plugin.hpp"
+
+using namespace std;
+
+const size_t CHUNK_SIZE = 64 * 1024;
+
+TransformPlugin::TransformPlugin(const string &file) : _file(file) {
+    // a bare name would be searched in the library path, like require() looks in node_modules
+    _handle = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (_handle == nullptr) throw runtime_error("Cannot load " + file + ": " + dlerror());
+    init = (decltype(init))dlsym(_handle, "cpx_init");
+    transform = (decltype(transform))dlsym(_handle, "cpx_transform");
+    finish = (decltype(finish))dlsym(_handle, "cpx_finish");
+    if (init == nullptr || transform == nullptr || finish == nullptr) {
+        dlclose(_handle);
+        throw runtime_error("Cannot load " + file + ": it has to export cpx_init, cpx_transform and cpx_finish");
+    }
+}
+
+TransformPlugin::~TransformPlugin() {
+    dlclose(_handle);
+}
+
+PluginChain::PluginChain(const vector<string> &files) {
+    for (const string &f : files) {
+        _plugins.push_back(make_unique<TransformPlugin>(f));
+    }
+}
+
+static void writeAll(int fd, const unsigned char *data, size_t len) {
+    for (size_t w = 0; w < len;) {
+        ssize_t n = write(fd, data + w, len - w);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error(strerror(errno));
+        }
+        w += n;
+    }
+}
+
+// Passes `data` through stage `s` and everything after it, an empty `data` is the end of the file
+static void feed(const vector<unique_ptr<TransformPlugin>> &plugins, vector<void *> &ctxs,
+                 vector<vector<unsigned char>> &bufs, size_t s, const unsigned char *data, size_t len, int out) {
+    if (s == plugins.size()) {
+        writeAll(out, data, len);
+        return;
+    }
+    const TransformPlugin &p = *plugins[s];
+    unsigned char *buf = bufs[s + 1].data();
+    size_t off = 0;
+    for (;;) {
+        size_t consumed = 0, produced = 0;
+        int rc = p.transform(ctxs[s], data + off, len - off, &consumed, buf, CHUNK_SIZE, &produced);
+        if (rc != 0) throw runtime_error(p.file() + ": " + strerror(rc));
+        if (consumed > len - off || produced > CHUNK_SIZE) throw runtime_error(p.file() + ": reported more than it got");
+        if (len > 0 && consumed == 0 && produced == 0) throw runtime_error(p.file() + ": made no progress");
+        off += consumed;
+        if (produced > 0) feed(plugins, ctxs, bufs, s + 1, buf, produced, out);
+        if (len == 0 ? produced == 0 : off == len) break;
+    }
+    if (len == 0) feed(plugins, ctxs, bufs, s + 1, buf, 0, out);
+}
+
+void PluginChain::run(const string &src, const string &dst, bool preserve) {
+    int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) throw runtime_error("Cannot open " + src + ": " + strerror(errno));
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        int err = errno;
+        close(in);
+        throw runtime_error("Cannot stat " + src + ": " + strerror(err));
+    }
+    optional<TempFile> out;
+    try {
+        out.emplace(dst, st.st_mode & 07777);
+    } catch (...) {
+        close(in);
+        throw;
+    }
+
+    string error;
+    vector<void *> ctxs(_plugins.size(), nullptr);
+    size_t started = 0;
+    for (; started < _plugins.size(); started++) {
+        int rc = _plugins[started]->init(CPX_PLUGIN_ABI, src.c_str(), dst.c_str(), &ctxs[started]);
+        if (rc != 0) {
+            error = _plugins[started]->file() + ": " + strerror(rc);
+            break;
+        }
+    }
+    thread_local vector<vector<unsigned char>> bufs;
+    if (bufs.size() < _plugins.size() + 1) bufs.resize(_plugins.size() + 1, vector<unsigned char>(CHUNK_SIZE));
+    try {
+        while (error.empty()) {
+            ssize_t n = read(in, bufs[0].data(), CHUNK_SIZE);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) throw runtime_error(strerror(errno));
+            feed(_plugins, ctxs, bufs, 0, bufs[0].data(), n, out->fd());
+            if (n == 0) break;
+        }
+    } catch (const exception &e) {
+        error = e.what();
+    }
+    for (size_t i = 0; i < started; i++) {
+        int rc = _plugins[i]->finish(ctxs[i]);
+        if (rc != 0 && error.empty()) error = _plugins[i]->file() + ": " + strerror(rc);
+    }
+
+    close(in);
+    if (error.empty()) {
+        try {
+            copyAttrs(out->fd(), st, preserve);
+            out->commit();
+        } catch (const exception &e) {
+            error = e.what();
+        }
+    }
+    // the temporary file is dropped, the previous destination stays
+    if (!error.empty()) throw runtime_error("Cannot transform " + src + " to " + dst + ": " + error);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "cpx_plugin.h"
+
+/*
+ * One `-t` shared object, see cpx_plugin.h for what it has to export.
+ */
+class TransformPlugin {
+public:
+    explicit TransformPlugin(const std::string &file);
+    ~TransformPlugin();
+    TransformPlugin(const TransformPlugin &) = delete;
+    TransformPlugin &operator=(const TransformPlugin &) = delete;
+
+    const std::string &file() const { return _file; }
+
+    decltype(&cpx_init) init;
+    decltype(&cpx_transform) transform;
+    decltype(&cpx_finish) finish;
+
+private:
+    std::string _file;
+    void *_handle = nullptr;
+};
+
+/*
+ * Streams files through a chain of plugins in the calling thread, with per-thread buffers between the stages. The
+ * output replaces the destination once the whole chain succeeded.
+ */
+class PluginChain {
+public:
+    explicit PluginChain(const std::vector<std::string> &files);
+
+    void run(const std::string &src, const std::string &dst, bool preserve);
+
+private:
+    std::vector<std::unique_ptr<TransformPlugin>> _plugins;
+};
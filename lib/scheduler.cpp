@@ -0,0 +1,85 @@
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include "scheduler.hpp"
+
+using namespace std;
+
+CopyScheduler::CopyScheduler(Runner run, SchedulerOpts opts) : _run(move(run)), _opts(opts) {
+    if (_opts.batch == 0) _opts.batch = 1;
+    _workers = _opts.threads > 0 ? _opts.threads : max(1u, thread::hardware_concurrency());
+    for (unsigned i = 0; i < _workers; i++) {
+        _threads.emplace_back(&CopyScheduler::work, this);
+    }
+}
+
+CopyScheduler::~CopyScheduler() {
+    close();
+}
+
+void CopyScheduler::submit(const string &dst, CopyJob job) {
+    lock_guard<mutex> lock(_mtx);
+    Slot &slot = _slots[dst];
+    if (slot.cancel) {
+        // whatever runs now is stale, the slot is queued again when it returns
+        slot.cancel->store(true);
+    } else if (!slot.next) {
+        _ready.push_back(dst);
+        _cv.notify_one();
+    }
+    if (slot.next) job.at = min(job.at, slot.next->at);
+    slot.next = move(job);
+}
+
+void CopyScheduler::close() {
+    {
+        lock_guard<mutex> lock(_mtx);
+        _closing = true;
+    }
+    _cv.notify_all();
+    for (thread &t : _threads) {
+        t.join();
+    }
+    _threads.clear();
+}
+
+void CopyScheduler::work() {
+    vector<Taken> batch;
+    unique_lock<mutex> lock(_mtx);
+    for (;;) {
+        _cv.wait(lock, [this]() { return !_ready.empty() || _closing; });
+        if (_ready.empty()) return;
+        // a burst of events is spread over the workers instead of going to whichever woke first
+        size_t take = min(_opts.batch, (_ready.size() + _workers - 1) / _workers);
+        while (!_ready.empty() && batch.size() < take) {
+            Slot &slot = _slots[_ready.front()];
+            slot.cancel = make_shared<atomic<bool>>(false);
+            batch.push_back(Taken{move(_ready.front()), move(*slot.next), slot.cancel});
+            slot.next.reset();
+            _ready.pop_front();
+        }
+        if (!_ready.empty()) _cv.notify_one();
+        lock.unlock();
+        for (size_t i = 0; i < batch.size(); i++) {
+            Taken &t = batch[i];
+            // replaced while it waited in this batch
+            if (!t.cancel->load()) _run(t.job, *t.cancel);
+            lock.lock();
+            auto it = _slots.find(t.dst);
+            it->second.cancel.reset();
+            if (it->second.next) {
+                _ready.push_back(move(t.dst));
+                _cv.notify_one();
+            } else {
+                _slots.erase(it);
+            }
+            if (i + 1 < batch.size()) lock.unlock();
+        }
+        batch.clear();
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+enum class JobKind : uint8_t { Copy, Remove, RemoveDir, MakeDir };
+
+struct CopyJob {
+    JobKind kind;
+    std::string src;
+    // Which of the Cpx instances sharing the scheduler the job belongs to
+    uint32_t owner = 0;
+    // When the (first still unhandled) event for the destination came in
+    std::chrono::steady_clock::time_point at = std::chrono::steady_clock::now();
+};
+
+class SchedulerOpts {
+public:
+    unsigned threads = 0;
+    // Jobs a worker takes off the queue at most at once, it takes no more than its share of what is ready
+    size_t batch = 16;
+};
+
+/*
+ * Sits between the watcher and the copy engine in watch mode. There is at most one pending job per destination: a
+ * new event replaces the pending one and cancels the running one, jobs for one destination never run concurrently and
+ * always in the order of their events, so an unlink can't be overtaken by the write before it.
+ */
+class CopyScheduler {
+public:
+    // `run` should check `cancel` now and then and stop early once it is set, a newer job for the destination is waiting
+    using Runner = std::function<void(const CopyJob &, const std::atomic<bool> &cancel)>;
+
+    explicit CopyScheduler(Runner run, SchedulerOpts opts = SchedulerOpts());
+    ~CopyScheduler();
+    CopyScheduler(const CopyScheduler &) = delete;
+    CopyScheduler &operator=(const CopyScheduler &) = delete;
+
+    void submit(const std::string &dst, CopyJob job);
+    // Runs what is still pending and stops the workers
+    void close();
+
+private:
+    struct Slot {
+        std::optional<CopyJob> next;
+        // Set while a job for the destination is running (or taken by a worker)
+        std::shared_ptr<std::atomic<bool>> cancel;
+    };
+    struct Taken {
+        std::string dst;
+        CopyJob job;
+        std::shared_ptr<std::atomic<bool>> cancel;
+    };
+
+    Runner _run;
+    SchedulerOpts _opts;
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    std::unordered_map<std::string, Slot> _slots;
+    std::deque<std::string> _ready;
+    std::vector<std::thread> _threads;
+    unsigned _workers;
+    bool _closing = false;
+
+    void work();
+};
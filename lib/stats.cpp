@@ -0,0 +1,82 @@
+#include <array>
+#include <atomic>
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <nlohmann/json.hpp>
+#include "stats.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+Stats stats;
+
+const char *COUNTER_NAMES[] = {"dirs_scanned", "entries_matched", "files_copied", "files_skipped", "files_linked",
+                               "files_removed", "files_compressed", "bytes_copied", "errors"};
+const char *SYS_NAMES[] = {"open", "stat", "getdents64", "read", "write", "copy_file_range", "sendfile", "ficlone",
+                           "link", "unlink", "mkdir", "io_uring_enter", "fiemap"};
+const char *PHASE_NAMES[] = {"args", "scan", "clean", "copy", "transform", "compress"};
+static_assert(size(COUNTER_NAMES) == (size_t)Counter::Count && size(SYS_NAMES) == (size_t)Sys::Count
+              && size(PHASE_NAMES) == (size_t)Phase::Count);
+
+size_t Histogram::bucketOf(uint64_t v) {
+    if (v < (1u << SUB_BITS)) return v;
+    int msb = 63 - __builtin_clzll(v);
+    return ((msb - SUB_BITS + 1) << SUB_BITS) + ((v >> (msb - SUB_BITS)) & ((1u << SUB_BITS) - 1));
+}
+
+uint64_t Histogram::valueOf(size_t bucket) {
+    if (bucket < (1u << SUB_BITS)) return bucket;
+    int msb = (bucket >> SUB_BITS) + SUB_BITS - 1;
+    return ((uint64_t)1 << msb) | (uint64_t)(bucket & ((1u << SUB_BITS) - 1)) << (msb - SUB_BITS);
+}
+
+void Histogram::record(uint64_t ns) {
+    if (!stats.enabled) return;
+    _buckets[bucketOf(ns)].fetch_add(1, memory_order_relaxed);
+    _count.fetch_add(1, memory_order_relaxed);
+    _sum.fetch_add(ns, memory_order_relaxed);
+    uint64_t top = _max.load(memory_order_relaxed);
+    while (ns > top && !_max.compare_exchange_weak(top, ns, memory_order_relaxed)) {}
+}
+
+uint64_t Histogram::quantile(double q) const {
+    uint64_t total = count();
+    if (total == 0) return 0;
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)ceil(q * total));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < _buckets.size(); b++) {
+        seen += _buckets[b].load(memory_order_relaxed);
+        if (seen >= rank) return valueOf(b);
+    }
+    return max();
+}
+
+static json histogramJson(const Histogram &h) {
+    uint64_t n = h.count();
+    return {{"count", n},
+            {"mean_us", n == 0 ? 0.0 : h.sum() / 1000.0 / n},
+            {"p50_us", h.quantile(0.5) / 1000.0},
+            {"p90_us", h.quantile(0.9) / 1000.0},
+            {"p99_us", h.quantile(0.99) / 1000.0},
+            {"p999_us", h.quantile(0.999) / 1000.0},
+            {"max_us", h.max() / 1000.0}};
+}
+
+string Stats::toJson() const {
+    json j;
+    for (size_t i = 0; i < _counters.size(); i++) {
+        j["counters"][COUNTER_NAMES[i]] = _counters[i].load(memory_order_relaxed);
+    }
+    for (size_t i = 0; i < _syscalls.size(); i++) {
+        j["syscalls"][SYS_NAMES[i]] = _syscalls[i].load(memory_order_relaxed);
+    }
+    for (size_t i = 0; i < _phases.size(); i++) {
+        j["phases"][PHASE_NAMES[i]] = {{"ms", _phases[i].load(memory_order_relaxed) / 1e6},
+                                       {"runs", _phaseRuns[i].load(memory_order_relaxed)}};
+    }
+    j["histograms"]["event_to_copy"] = histogramJson(eventToCopy);
+    j["histograms"]["copy"] = histogramJson(copyTime);
+    return j.dump();
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+enum class Counter : uint8_t { DirsScanned, EntriesMatched, FilesCopied, FilesSkipped, FilesLinked, FilesRemoved,
+                               FilesCompressed, BytesCopied, Errors, Count };
+enum class Sys : uint8_t { Open, Stat, Getdents, Read, Write, CopyRange, Sendfile, Ficlone, Link, Unlink, Mkdir,
+                           UringEnter, Fiemap, Count };
+enum class Phase : uint8_t { Args, Scan, Clean, Copy, Transform, Compress, Count };
+
+/*
+ * Log-linear latency histogram in the style of HdrHistogram: 16 linear sub-buckets per power of two, so every
+ * recorded value is kept within 1/16 (6.25%) of its real value. Recording is one relaxed atomic increment.
+ */
+class Histogram {
+public:
+    void record(uint64_t ns);
+    uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return _sum.load(std::memory_order_relaxed); }
+    uint64_t max() const { return _max.load(std::memory_order_relaxed); }
+    // Value at quantile `q` (0..1) in nanoseconds, the lower end of its bucket
+    uint64_t quantile(double q) const;
+
+private:
+    static const int SUB_BITS = 4;
+    std::array<std::atomic<uint64_t>, 64 << SUB_BITS> _buckets{};
+    std::atomic<uint64_t> _count{0};
+    std::atomic<uint64_t> _sum{0};
+    std::atomic<uint64_t> _max{0};
+
+    static size_t bucketOf(uint64_t v);
+    static uint64_t valueOf(size_t bucket);
+};
+
+/*
+ * Process wide counters for --stats. Everything is a no-op until `enabled` is set, counters are relaxed atomics so
+ * they cost one uncontended check on the hot paths when stats are off.
+ */
+class Stats {
+public:
+    bool enabled = false;
+    // From a watch event to its copy landing, for the jobs that were not superseded
+    Histogram eventToCopy;
+    // Of every single file copy (or transform)
+    Histogram copyTime;
+
+    void add(Counter c, uint64_t n = 1) {
+        if (enabled) _counters[(size_t)c].fetch_add(n, std::memory_order_relaxed);
+    }
+    void sys(Sys s, uint64_t n = 1) {
+        if (enabled) _syscalls[(size_t)s].fetch_add(n, std::memory_order_relaxed);
+    }
+    void time(Phase p, uint64_t ns) {
+        if (!enabled) return;
+        _phases[(size_t)p].fetch_add(ns, std::memory_order_relaxed);
+        _phaseRuns[(size_t)p].fetch_add(1, std::memory_order_relaxed);
+    }
+    std::string toJson() const;
+
+private:
+    std::array<std::atomic<uint64_t>, (size_t)Counter::Count> _counters{};
+    std::array<std::atomic<uint64_t>, (size_t)Sys::Count> _syscalls{};
+    std::array<std::atomic<uint64_t>, (size_t)Phase::Count> _phases{};
+    std::array<std::atomic<uint64_t>, (size_t)Phase::Count> _phaseRuns{};
+};
+
+extern Stats stats;
+
+// Adds the time until it goes out of scope to a phase. Phases run concurrently (copies happen during the scan), and
+// Copy, Transform and Compress are summed over all threads, so they can add up to more than the wall time.
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Phase p) : _phase(p), _start(std::chrono::steady_clock::now()) {}
+    ~PhaseTimer() { stop(); }
+    void stop() {
+        if (!_stopped) stats.time(_phase, elapsed());
+        _stopped = true;
+    }
+    uint64_t elapsed() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+    }
+
+private:
+    Phase _phase;
+    bool _stopped = false;
+    std::chrono::steady_clock::time_point _start;
+};
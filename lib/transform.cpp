@@ -0,0 +1,157 @@
+#include <cerrno>
+#include <string>
+#include <thread>
+#include <vector>
+#include <spawn.h>
+#include <fcntl.h>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <variant>
+#include <optional>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <functional>
+#include <string_view>
+#include "copy.hpp"
+#include "transform.hpp"
+#include "../pkgs/shellq.hpp"
+
+using namespace std;
+
+extern char **environ;
+
+// stands in for $FILE while parsing, then marks the slots
+const string FILE_SLOT = "\x01" "FILE" "\x01";
+
+CommandTemplate::CommandTemplate(const string &command) : _command(command) {
+    env_t env = function<string(string)>([](string key) {
+        if (key == "FILE") return FILE_SLOT;
+        const char *v = getenv(key.c_str());
+        return string(v == nullptr ? "" : v);
+    });
+    ShqResult res = parseShqTokens(command, &env);
+    vector<vector<pair<string, bool>>> args;
+    for (const ShqToken &t : res.tokens) {
+        if (t.kind != ShqKind::Word && t.kind != ShqKind::Glob) return;
+        string_view word = res.text(t);
+        vector<pair<string, bool>> parts;
+        size_t pos = 0, at;
+        while ((at = word.find(FILE_SLOT, pos)) != string::npos) {
+            if (at > pos) parts.emplace_back(word.substr(pos, at - pos), false);
+            parts.emplace_back("", true);
+            pos = at + FILE_SLOT.size();
+        }
+        if (pos < word.size() || parts.empty()) parts.emplace_back(word.substr(pos), false);
+        args.push_back(parts);
+    }
+    _args = args;
+}
+
+void CommandTemplate::expand(string_view file, vector<string> &argv) const {
+    argv.clear();
+    if (shell()) {
+        argv = {"/bin/sh", "-c", _command};
+        return;
+    }
+    for (auto &parts : _args) {
+        string arg;
+        for (auto &[text, slot] : parts) {
+            if (slot) arg += file;
+            else arg += text;
+        }
+        argv.push_back(arg);
+    }
+}
+
+Transformer::Transformer(const vector<string> &commands, unsigned jobs)
+    : _slots(jobs > 0 ? jobs : max(1u, thread::hardware_concurrency())) {
+    for (const string &c : commands) {
+        _commands.emplace_back(c);
+    }
+}
+
+void Transformer::run(const string &src, const string &dst, bool preserve) {
+    int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) throw runtime_error("Cannot open " + src + ": " + strerror(errno));
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        int err = errno;
+        close(in);
+        throw runtime_error("Cannot stat " + src + ": " + strerror(err));
+    }
+    optional<TempFile> out;
+    try {
+        out.emplace(dst, st.st_mode & 07777);
+    } catch (...) {
+        close(in);
+        throw;
+    }
+
+    vector<string> envs;
+    for (char **e = environ; *e != nullptr; e++) {
+        if (strncmp(*e, "FILE=", 5) != 0) envs.push_back(*e);
+    }
+    envs.push_back("FILE=" + src);
+    vector<char *> envp;
+    for (string &e : envs) envp.push_back(e.data());
+    envp.push_back(nullptr);
+
+    _slots.acquire();
+    vector<pid_t> pids;
+    string error;
+    int stdinFd = in;
+    vector<string> argv;
+    for (size_t k = 0; k < _commands.size(); k++) {
+        int pipefd[2] = {-1, -1};
+        bool last = k + 1 == _commands.size();
+        if (!last && pipe2(pipefd, O_CLOEXEC) != 0) {
+            error = strerror(errno);
+            break;
+        }
+        int stdoutFd = last ? out->fd() : pipefd[1];
+        _commands[k].expand(src, argv);
+        vector<char *> cargv;
+        for (string &a : argv) cargv.push_back(a.data());
+        cargv.push_back(nullptr);
+
+        posix_spawn_file_actions_t fa;
+        posix_spawn_file_actions_init(&fa);
+        posix_spawn_file_actions_adddup2(&fa, stdinFd, 0);
+        posix_spawn_file_actions_adddup2(&fa, stdoutFd, 1);
+        pid_t pid;
+        int err = posix_spawnp(&pid, cargv[0], &fa, nullptr, cargv.data(), envp.data());
+        posix_spawn_file_actions_destroy(&fa);
+        if (stdinFd != in) close(stdinFd);
+        if (!last) close(pipefd[1]);
+        if (err != 0) {
+            error = string(argv[0]) + ": " + strerror(err);
+            if (!last) close(pipefd[0]);
+            break;
+        }
+        pids.push_back(pid);
+        stdinFd = last ? -1 : pipefd[0];
+    }
+    if (stdinFd >= 0 && stdinFd != in) close(stdinFd);
+    for (pid_t pid : pids) {
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        if (error.empty() && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+            error = "command exited with " + to_string(WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+        }
+    }
+    _slots.release();
+
+    close(in);
+    if (error.empty()) {
+        try {
+            copyAttrs(out->fd(), st, preserve);
+            out->commit();
+        } catch (const exception &e) {
+            error = e.what();
+        }
+    }
+    // the temporary file is dropped, the previous destination stays
+    if (!error.empty()) throw runtime_error("Cannot transform " + src + " to " + dst + ": " + error);
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <semaphore>
+#include <string_view>
+
+/*
+ * A `--command` parsed once with shellq. `$FILE` becomes a slot that is filled with the source path of each file,
+ * other variables are taken from the environment at parse time. Commands that use shell operators (pipes,
+ * redirections, ...) can't be spawned directly and run through /bin/sh with FILE exported instead.
+ */
+class CommandTemplate {
+public:
+    explicit CommandTemplate(const std::string &command);
+
+    bool shell() const { return _args.empty(); }
+    void expand(std::string_view file, std::vector<std::string> &argv) const;
+
+private:
+    // every argument is a list of literal pieces and $FILE slots (second = true)
+    std::vector<std::vector<std::pair<std::string, bool>>> _args;
+    std::string _command;
+};
+
+/*
+ * Runs files through the `--command`s with posix_spawn, at most `jobs` files at a time. The source file is the stdin
+ * of the first command and a TempFile next to the destination the stdout of the last one, commands in between are
+ * joined by pipes, so the data never passes through cpx. The destination is only replaced when every command succeeded.
+ */
+class Transformer {
+public:
+    Transformer(const std::vector<std::string> &commands, unsigned jobs = 0);
+
+    void run(const std::string &src, const std::string &dst, bool preserve);
+
+private:
+    std::vector<CommandTemplate> _commands;
+    std::counting_semaphore<> _slots;
+};
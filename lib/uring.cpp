@@ -0,0 +1,213 @@
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <fcntl.h>
+#include <cstring>
+#include <unistd.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <functional>
+#include <sys/utsname.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring.hpp"
+#include "stats.hpp"
+
+using namespace std;
+
+// open src, open dst, read, write, close src, close dst
+const unsigned OPS_PER_FILE = 6;
+
+static int ringSetup(unsigned entries, io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ringEnter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0);
+}
+
+static int ringRegister(int fd, unsigned op, void *arg, unsigned n) {
+    return syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+static bool kernelAtLeast(int major, int minor) {
+    utsname u;
+    int ma = 0, mi = 0;
+    if (uname(&u) != 0 || sscanf(u.release, "%d.%d", &ma, &mi) != 2) return false;
+    return ma > major || (ma == major && mi >= minor);
+}
+
+UringCopier::UringCopier(unsigned depth, size_t maxSize) : _depth(depth), _maxSize(maxSize) {
+    if (!setup()) teardown();
+}
+
+UringCopier::~UringCopier() {
+    teardown();
+}
+
+bool UringCopier::setup() {
+    // openat/close on direct descriptors, which the linked chains rely on, arrived in 5.15
+    if (_depth == 0 || !kernelAtLeast(5, 15)) return false;
+    unsigned entries = 1;
+    while (entries < _depth * OPS_PER_FILE) entries <<= 1;
+    io_uring_params p{};
+    _fd = ringSetup(entries, &p);
+    if (_fd < 0) return false;
+    _sqEntries = p.sq_entries;
+
+    _sqRingSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    _cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) _sqRingSize = _cqRingSize = max(_sqRingSize, _cqRingSize);
+    _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sqRing == MAP_FAILED) {
+        _sqRing = nullptr;
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        _cqRing = _sqRing;
+    } else {
+        _cqRing = mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        if (_cqRing == MAP_FAILED) {
+            _cqRing = nullptr;
+            return false;
+        }
+    }
+    _sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    _sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) {
+        _sqes = nullptr;
+        return false;
+    }
+    char *sq = (char *)_sqRing;
+    char *cq = (char *)_cqRing;
+    _sqHead = (uint32_t *)(sq + p.sq_off.head);
+    _sqTail = (uint32_t *)(sq + p.sq_off.tail);
+    _sqMask = (uint32_t *)(sq + p.sq_off.ring_mask);
+    _sqArray = (uint32_t *)(sq + p.sq_off.array);
+    _cqHead = (uint32_t *)(cq + p.cq_off.head);
+    _cqTail = (uint32_t *)(cq + p.cq_off.tail);
+    _cqMask = (uint32_t *)(cq + p.cq_off.ring_mask);
+    _cqes = cq + p.cq_off.cqes;
+
+    vector<char> probeBuf(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    io_uring_probe *probe = (io_uring_probe *)probeBuf.data();
+    if (ringRegister(_fd, IORING_REGISTER_PROBE, probe, 256) < 0) return false;
+    for (int op : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE}) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+    }
+    vector<int> files(_depth * 2, -1);
+    if (ringRegister(_fd, IORING_REGISTER_FILES, files.data(), files.size()) < 0) return false;
+    _bufs.resize(_depth * _maxSize);
+    return true;
+}
+
+void UringCopier::teardown() {
+    if (_sqes != nullptr) munmap(_sqes, _sqesSize);
+    if (_cqRing != nullptr && _cqRing != _sqRing) munmap(_cqRing, _cqRingSize);
+    if (_sqRing != nullptr) munmap(_sqRing, _sqRingSize);
+    _sqes = _sqRing = _cqRing = nullptr;
+    if (_fd >= 0) close(_fd);
+    _fd = -1;
+}
+
+void UringCopier::copy(const vector<UringJob> &jobs, const function<void(const UringJob &, int)> &done) {
+    if (_fd < 0) throw runtime_error("io_uring is not available");
+    struct Slot {
+        size_t job;
+        unsigned left;
+        int err;
+    };
+    vector<Slot> slots(_depth);
+    vector<unsigned> free;
+    for (unsigned s = _depth; s-- > 0;) {
+        free.push_back(s);
+    }
+    io_uring_sqe *sqes = (io_uring_sqe *)_sqes;
+    io_uring_cqe *cqes = (io_uring_cqe *)_cqes;
+    size_t next = 0;
+    size_t inflight = 0;
+    while (next < jobs.size() || inflight > 0) {
+        unsigned queued = 0;
+        uint32_t tail = *_sqTail;
+        while (next < jobs.size() && !free.empty()) {
+            const UringJob &j = jobs[next];
+            if ((size_t)j.size > _maxSize) {
+                done(j, EFBIG);
+                next++;
+                continue;
+            }
+            unsigned s = free.back();
+            free.pop_back();
+            slots[s] = Slot{next, OPS_PER_FILE, 0};
+            char *buf = _bufs.data() + s * _maxSize;
+            for (unsigned op = 0; op < OPS_PER_FILE; op++) {
+                uint32_t idx = tail & *_sqMask;
+                io_uring_sqe *sqe = &sqes[idx];
+                memset(sqe, 0, sizeof(*sqe));
+                sqe->user_data = (uint64_t)s << 8 | op;
+                // a failed open of the source cancels the rest, nothing is open yet. Past it the chain goes on
+                // whatever fails so that both closes run and the slot's descriptors are free for the next file.
+                if (op == 0) sqe->flags = IOSQE_IO_LINK;
+                else if (op + 1 < OPS_PER_FILE) sqe->flags = IOSQE_IO_HARDLINK;
+                switch (op) {
+                    case 0:
+                    case 1:
+                        sqe->opcode = IORING_OP_OPENAT;
+                        sqe->fd = AT_FDCWD;
+                        sqe->addr = (uint64_t)(op == 0 ? j.src.c_str() : j.dst.c_str());
+                        // O_CLOEXEC is rejected for direct descriptors, they are never inherited anyway
+                        sqe->open_flags = op == 0 ? O_RDONLY : O_WRONLY | O_CREAT | O_TRUNC;
+                        sqe->len = op == 0 ? 0 : j.mode & 07777;
+                        sqe->file_index = s * 2 + op + 1;
+                        break;
+                    case 2:
+                    case 3:
+                        sqe->opcode = op == 2 ? IORING_OP_READ : IORING_OP_WRITE;
+                        sqe->flags |= IOSQE_FIXED_FILE;
+                        sqe->fd = s * 2 + (op - 2);
+                        sqe->addr = (uint64_t)buf;
+                        sqe->len = j.size;
+                        sqe->off = 0;
+                        break;
+                    default:
+                        sqe->opcode = IORING_OP_CLOSE;
+                        sqe->file_index = s * 2 + (op - 4) + 1;
+                        break;
+                }
+                _sqArray[idx] = idx;
+                tail++;
+            }
+            queued += OPS_PER_FILE;
+            next++;
+            inflight++;
+        }
+        __atomic_store_n(_sqTail, tail, __ATOMIC_RELEASE);
+        if (inflight == 0) continue;
+        stats.sys(Sys::UringEnter);
+        if (ringEnter(_fd, queued, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            throw runtime_error(string("io_uring_enter: ") + strerror(errno));
+        }
+
+        uint32_t head = *_cqHead;
+        uint32_t ctail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+        for (; head != ctail; head++) {
+            io_uring_cqe &cqe = cqes[head & *_cqMask];
+            unsigned s = cqe.user_data >> 8;
+            unsigned op = cqe.user_data & 0xff;
+            Slot &slot = slots[s];
+            const UringJob &j = jobs[slot.job];
+            // the first error is the one that counts, what fails after it only follows from it
+            if (slot.err == 0) {
+                if (cqe.res < 0) slot.err = -cqe.res;
+                // a short read or write (the file changed since it was stat'ed) breaks the copy
+                else if ((op == 2 || op == 3) && cqe.res != j.size) slot.err = EIO;
+            }
+            if (--slot.left > 0) continue;
+            done(j, slot.err);
+            free.push_back(s);
+            inflight--;
+        }
+        __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+    }
+}
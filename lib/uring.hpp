@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <sys/types.h>
+
+struct UringJob {
+    std::string src;
+    std::string dst;
+    off_t size;
+    mode_t mode;
+};
+
+/*
+ * Copies small files with io_uring. Every file is one linked chain open(src) -> open(dst) -> read -> write ->
+ * close -> close on direct descriptors, so a whole batch of files costs a handful of io_uring_enter calls instead of
+ * five or six syscalls per file. Once the source is open the closes run however the ops before them ended. Files must fit in `maxSize` and their destination directory has to exist.
+ */
+class UringCopier {
+public:
+    explicit UringCopier(unsigned depth = 64, size_t maxSize = 64 * 1024);
+    ~UringCopier();
+    UringCopier(const UringCopier &) = delete;
+    UringCopier &operator=(const UringCopier &) = delete;
+
+    // False when the kernel has no (usable) io_uring, callers then use the synchronous engine
+    bool available() const { return _fd >= 0; }
+    size_t maxSize() const { return _maxSize; }
+    // `done` gets 0 or the first error of a file's chain; failed files have not been copied completely
+    void copy(const std::vector<UringJob> &jobs, const std::function<void(const UringJob &, int)> &done);
+
+private:
+    int _fd = -1;
+    unsigned _depth;
+    size_t _maxSize;
+    unsigned _sqEntries = 0;
+    void *_sqRing = nullptr;
+    void *_cqRing = nullptr;
+    size_t _sqRingSize = 0;
+    size_t _cqRingSize = 0;
+    void *_sqes = nullptr;
+    size_t _sqesSize = 0;
+    uint32_t *_sqHead, *_sqTail, *_sqMask, *_sqArray;
+    uint32_t *_cqHead, *_cqTail, *_cqMask;
+    void *_cqes;
+    std::vector<char> _bufs;
+
+    bool setup();
+    void teardown();
+};
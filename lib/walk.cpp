@@ -0,0 +1,216 @@
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <functional>
+#include <sys/syscall.h>
+#include "walk.hpp"
+#include "stats.hpp"
+
+using namespace std;
+
+// Directories waiting in a queue keep their parent open so they can be opened relative to it. Past this many open
+// descriptors new tasks fall back to opening by path, so wide trees can't run the process out of descriptors.
+const int MAX_HELD_FDS = 256;
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct DirFd {
+    int fd;
+    atomic<int> *held;
+    ~DirFd() {
+        close(fd);
+        (*held)--;
+    }
+};
+
+// The directories above a task, only tracked when following symlinks, where a link back up would never end
+struct DirId {
+    dev_t dev;
+    ino_t ino;
+    shared_ptr<const DirId> parent;
+};
+
+struct WalkTask {
+    string path;
+    shared_ptr<DirFd> parent;
+    string name;
+    shared_ptr<const DirId> above;
+};
+
+struct WalkQueue {
+    mutex mtx;
+    deque<WalkTask> tasks;
+};
+
+class Walker {
+public:
+    Walker(const WalkOpts &opts, const function<void(const WalkEntry &)> &onEntry) : opts(opts), onEntry(onEntry) {}
+
+    void run(const string &root) {
+        unsigned n = opts.threads > 0 ? opts.threads : max(1u, thread::hardware_concurrency());
+        queues = vector<WalkQueue>(n);
+        push(0, WalkTask{root, nullptr, ""});
+        vector<thread> workers;
+        for (unsigned i = 1; i < n; i++) {
+            workers.emplace_back(&Walker::work, this, i);
+        }
+        work(0);
+        for (thread &t : workers) {
+            t.join();
+        }
+    }
+
+private:
+    const WalkOpts &opts;
+    const function<void(const WalkEntry &)> &onEntry;
+    vector<WalkQueue> queues;
+    atomic<size_t> pending{0};
+    atomic<int> held{0};
+
+    void push(unsigned self, WalkTask &&task) {
+        pending++;
+        lock_guard<mutex> lock(queues[self].mtx);
+        queues[self].tasks.push_back(move(task));
+    }
+
+    bool next(unsigned self, WalkTask &out) {
+        {
+            // own queue is used as a stack (depth first), others are robbed from the front where the biggest subtrees are
+            lock_guard<mutex> lock(queues[self].mtx);
+            if (!queues[self].tasks.empty()) {
+                out = move(queues[self].tasks.back());
+                queues[self].tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues.size(); k++) {
+            WalkQueue &q = queues[(self + k) % queues.size()];
+            lock_guard<mutex> lock(q.mtx);
+            if (q.tasks.empty()) continue;
+            out = move(q.tasks.front());
+            q.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void work(unsigned self) {
+        WalkTask task;
+        unsigned idle = 0;
+        while (pending > 0) {
+            if (!next(self, task)) {
+                if (++idle < 64) this_thread::yield();
+                else this_thread::sleep_for(chrono::microseconds(50));
+                continue;
+            }
+            idle = 0;
+            scan(self, task);
+            task.parent.reset();
+            task.above.reset();
+            pending--;
+        }
+    }
+
+    void scan(unsigned self, WalkTask &task) {
+        int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+        if (!opts.followSymlinks) flags |= O_NOFOLLOW;
+        int fd = task.parent ? openat(task.parent->fd, task.name.c_str(), flags) : open(task.path.c_str(), flags);
+        stats.sys(Sys::Open);
+        if (fd < 0) {
+            if (opts.onError != nullptr) (*opts.onError)(task.path, errno);
+            return;
+        }
+        shared_ptr<const DirId> here;
+        if (opts.followSymlinks) {
+            struct stat st;
+            int err = fstat(fd, &st) != 0 ? errno : 0;
+            for (const DirId *d = task.above.get(); d != nullptr && err == 0; d = d->parent.get()) {
+                if (d->dev == st.st_dev && d->ino == st.st_ino) err = ELOOP;
+            }
+            if (err != 0) {
+                close(fd);
+                if (opts.onError != nullptr) (*opts.onError)(task.path, err);
+                return;
+            }
+            here = make_shared<const DirId>(DirId{st.st_dev, st.st_ino, task.above});
+        }
+        held++;
+        stats.add(Counter::DirsScanned);
+        shared_ptr<DirFd> dir(new DirFd{fd, &held});
+
+        thread_local vector<char> buf(32 * 1024);
+        thread_local string path;
+        path = task.path == "." ? "" : task.path;
+        if (!path.empty() && path.back() != '/') path += '/';
+        size_t len = path.size();
+        for (;;) {
+            long n = syscall(SYS_getdents64, fd, buf.data(), buf.size());
+            stats.sys(Sys::Getdents);
+            if (n <= 0) break;
+            for (long off = 0; off < n;) {
+                linux_dirent64 *d = (linux_dirent64 *)(buf.data() + off);
+                off += d->d_reclen;
+                const char *name = d->d_name;
+                if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) continue;
+                unsigned char type = d->d_type;
+                if (type == DT_UNKNOWN || (type == DT_LNK && opts.followSymlinks)) {
+                    struct stat st;
+                    stats.sys(Sys::Stat);
+                    if (fstatat(fd, name, &st, opts.followSymlinks ? 0 : AT_SYMLINK_NOFOLLOW) != 0) continue;
+                    type = IFTODT(st.st_mode);
+                }
+                // there is nothing to copy in FIFOs, sockets and devices, and opening a FIFO blocks
+                if (type == DT_FIFO || type == DT_SOCK || type == DT_CHR || type == DT_BLK) continue;
+                path.resize(len);
+                path += name;
+                WalkEntry e{path, fd, name, type, d->d_ino};
+                if (type == DT_DIR) {
+                    if (opts.glob != nullptr && !opts.glob->couldMatchBelow(path)) {
+                        if (opts.includeDirs && opts.glob->match(path)) onEntry(e);
+                        continue;
+                    }
+                    if (opts.includeDirs && (opts.glob == nullptr || opts.glob->match(path))) onEntry(e);
+                    bool relative = held < MAX_HELD_FDS;
+                    push(self, WalkTask{path, relative ? dir : nullptr, relative ? name : "", here});
+                } else if (opts.glob == nullptr || opts.glob->match(path)) {
+                    onEntry(e);
+                }
+            }
+        }
+    }
+};
+
+void walk(const string &root, const WalkOpts &opts, const function<void(const WalkEntry &)> &onEntry) {
+    struct stat st;
+    if (stat(root.empty() ? "." : root.c_str(), &st) != 0) {
+        if (errno == ENOENT) return;
+        throw runtime_error("Cannot read " + root + ": " + strerror(errno));
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        if (!S_ISREG(st.st_mode)) return;
+        if (opts.glob != nullptr && !opts.glob->match(root)) return;
+        WalkEntry e{root, AT_FDCWD, root.c_str(), DT_REG, st.st_ino};
+        onEntry(e);
+        return;
+    }
+    Walker w(opts, onEntry);
+    w.run(root.empty() ? "." : root);
+}
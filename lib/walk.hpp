@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include "../pkgs/co/picomatch.hpp"
+
+struct WalkEntry {
+    // Path of the entry, prefixed with the walk root unless the root is "."
+    std::string_view path;
+    // The containing directory and the name inside it, only valid during the callback
+    int dirfd;
+    const char *name;
+    unsigned char type;
+    uint64_t ino;
+};
+
+class WalkOpts {
+public:
+    unsigned threads = 0;
+    // Directories linking back to one of their ancestors are reported to onError with ELOOP and not entered
+    bool followSymlinks = false;
+    bool includeDirs = false;
+    // When set, only matching entries are reported and directories nothing could match below are skipped
+    const PicomatchSet *glob = nullptr;
+    std::function<void(std::string_view, int)> *onError = nullptr;
+};
+
+// Walks `root` on a work-stealing thread pool, `onEntry` is called concurrently from all of the workers. FIFOs,
+// sockets and device nodes are left out.
+void walk(const std::string &root, const WalkOpts &opts, const std::function<void(const WalkEntry &)> &onEntry);
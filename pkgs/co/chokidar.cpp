@@ -0,0 +1,377 @@
+#include <mutex>
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <string_view>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include "poller.hpp"
+#include "chokidar.hpp"
+
+/*
+ * Modeled after https://github.com/paulmillr/chokidar
+ * The original code was licensed under the MIT License -> https://github.com/paulmillr/chokidar/blob/master/LICENSE
+ * Only the recursive directory watching of chokidar is implemented, on top of inotify with a single epoll thread.
+ * Bursts of IN_MODIFY/IN_CLOSE_WRITE/IN_MOVED_* for one path are merged into one event that is delivered once the
+ * path has been quiet for `coalesceMs` (or after 10x that if it never goes quiet).
+ */
+
+using namespace std;
+
+const int FREE = -2;
+const int ROOT = -1;
+// The parent of directories whose parent went away while they were still watched, they can't be named anymore
+const int DETACHED = -3;
+const int NO_DIR = -1;
+const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM
+                            | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+FSWatcher::FSWatcher(optional<ChokidarOpts> opts) {
+    _opts = opts.value_or(ChokidarOpts());
+    _ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_ifd < 0) throw runtime_error(string("inotify_init1: ") + strerror(errno));
+    _efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_efd < 0 || _epfd < 0) throw runtime_error(string("epoll: ") + strerror(errno));
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = _ifd;
+    epoll_ctl(_epfd, EPOLL_CTL_ADD, _ifd, &ev);
+    ev.data.fd = _efd;
+    epoll_ctl(_epfd, EPOLL_CTL_ADD, _efd, &ev);
+}
+
+FSWatcher::~FSWatcher() {
+    close();
+    if (_ifd >= 0) ::close(_ifd);
+    if (_efd >= 0) ::close(_efd);
+    if (_epfd >= 0) ::close(_epfd);
+}
+
+void FSWatcher::on(function<void(WatchEvent, string_view)> listener) {
+    lock_guard<mutex> lock(_mtx);
+    _listeners.push_back(listener);
+}
+
+void FSWatcher::add(const string &dir) {
+    string path = dir;
+    while (path.size() > 1 && path.back() == '/') path.pop_back();
+    if (_opts.usePolling || (_opts.autoPolling && needsPolling(path))) {
+        {
+            lock_guard<mutex> lock(_mtx);
+            if (_closed) return;
+            if (!_poller) {
+                PollOpts po;
+                po.followSymlinks = _opts.followSymlinks;
+                po.ignoreInitial = _opts.ignoreInitial;
+                po.intervalMs = _opts.intervalMs;
+                po.maxIntervalMs = _opts.maxIntervalMs;
+                po.dirFilter = _opts.dirFilter;
+                // under the watcher lock like the inotify events, so listeners never run concurrently
+                _poller = make_unique<StatPoller>(po, [this](WatchEvent ev, string_view p) {
+                    lock_guard<mutex> lock(_mtx);
+                    emit(ev, p);
+                });
+            }
+        }
+        // outside of the lock, the poller's initial scan takes it for every event
+        _poller->add(path);
+        return;
+    }
+    {
+        lock_guard<mutex> lock(_mtx);
+        if (_closed) return;
+        if (watchDir(path, ROOT, path, true, false) < 0 && errno != 0) {
+            throw runtime_error("Cannot watch " + dir + ": " + strerror(errno));
+        }
+    }
+    if (!_thread.joinable()) _thread = thread(&FSWatcher::loop, this);
+}
+
+void FSWatcher::close() {
+    {
+        lock_guard<mutex> lock(_mtx);
+        if (_closed) return;
+        _closed = true;
+    }
+    uint64_t one = 1;
+    if (write(_efd, &one, sizeof(one)) < 0) {}
+    if (_thread.joinable()) _thread.join();
+    if (_poller) _poller->close();
+}
+
+size_t FSWatcher::watched() const {
+    size_t n;
+    {
+        lock_guard<mutex> lock(_mtx);
+        n = _slots.size();
+    }
+    return n + (_poller ? _poller->watched() : 0);
+}
+
+void FSWatcher::emit(WatchEvent ev, string_view path) {
+    for (auto &l : _listeners) {
+        l(ev, path);
+    }
+}
+
+void FSWatcher::setName(int slot, int parent, string_view name) {
+    if (_dirs[slot].parent != parent) {
+        unlink(slot);
+        link(slot, parent);
+    }
+    if (_dirs[slot].name != name) _dirs[slot].name = name;
+}
+
+// Adds `slot` to the subdirectories of `parent`
+void FSWatcher::link(int slot, int parent) {
+    Dir &d = _dirs[slot];
+    d.parent = parent;
+    d.prev = NO_DIR;
+    d.next = parent >= 0 ? _dirs[parent].child : NO_DIR;
+    if (parent < 0) return;
+    if (d.next >= 0) _dirs[d.next].prev = slot;
+    _dirs[parent].child = slot;
+}
+
+void FSWatcher::unlink(int slot) {
+    Dir &d = _dirs[slot];
+    if (d.parent >= 0) {
+        if (d.prev >= 0) _dirs[d.prev].next = d.next;
+        else _dirs[d.parent].child = d.next;
+        if (d.next >= 0) _dirs[d.next].prev = d.prev;
+    }
+    d.next = d.prev = NO_DIR;
+}
+
+// False for directories that lost their parent
+bool FSWatcher::pathOf(int slot, string &out) const {
+    thread_local vector<int> chain;
+    chain.clear();
+    int s = slot;
+    for (; s >= 0; s = _dirs[s].parent) {
+        chain.push_back(s);
+    }
+    out.clear();
+    for (size_t i = chain.size(); i-- > 0;) {
+        if (!out.empty() && out.back() != '/') out += '/';
+        out += _dirs[chain[i]].name;
+    }
+    return s == ROOT;
+}
+
+int FSWatcher::childOf(int slot, string_view name) const {
+    for (int c = _dirs[slot].child; c >= 0; c = _dirs[c].next) {
+        if (_dirs[c].name == name) return c;
+    }
+    return -1;
+}
+
+void FSWatcher::dropSubtree(int slot) {
+    thread_local vector<int> stack;
+    stack.assign(1, slot);
+    while (!stack.empty()) {
+        int s = stack.back();
+        stack.pop_back();
+        inotify_rm_watch(_ifd, _dirs[s].wd);
+        for (int c = _dirs[s].child; c >= 0; c = _dirs[c].next) {
+            stack.push_back(c);
+        }
+    }
+}
+
+int FSWatcher::watchDir(string &path, int parent, string_view name, bool initial, bool rescan) {
+    errno = 0;
+    if (_opts.dirFilter != nullptr && !(*_opts.dirFilter)(path)) return -1;
+    uint32_t mask = WATCH_MASK;
+    if (!_opts.followSymlinks) mask |= IN_DONT_FOLLOW;
+    int wd = inotify_add_watch(_ifd, path.c_str(), mask);
+    if (wd < 0) {
+        if (errno == ENOSPC) emit(WatchEvent::Error, path);
+        return -1;
+    }
+    auto [it, added] = _slots.emplace(wd, 0);
+    if (added) {
+        if (_free.empty()) {
+            it->second = _dirs.size();
+            _dirs.push_back(Dir{wd, FREE, NO_DIR, NO_DIR, NO_DIR, string()});
+        } else {
+            it->second = _free.back();
+            _free.pop_back();
+            _dirs[it->second].wd = wd;
+        }
+    }
+    int slot = it->second;
+    // the same inode reached again (a directory moved inside the tree) keeps its descriptor
+    setName(slot, parent, name);
+    if (!added && !rescan) return slot;
+    if (parent != ROOT && (!initial || !_opts.ignoreInitial)) report(WatchEvent::AddDir, path, initial);
+
+    DIR *d = opendir(path.c_str());
+    if (d == nullptr) return slot;
+    size_t len = path.size();
+    while (dirent *e = readdir(d)) {
+        if (e->d_name[0] == '.' && (e->d_name[1] == 0 || (e->d_name[1] == '.' && e->d_name[2] == 0))) continue;
+        unsigned char type = e->d_type;
+        if (path.back() != '/') path += '/';
+        path += e->d_name;
+        if (type == DT_UNKNOWN || (type == DT_LNK && _opts.followSymlinks)) {
+            struct stat st;
+            int flags = _opts.followSymlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+            if (fstatat(dirfd(d), e->d_name, &st, flags) == 0) type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+        }
+        if (type == DT_DIR) {
+            watchDir(path, slot, e->d_name, initial, rescan);
+        } else if (!initial || !_opts.ignoreInitial) {
+            report(WatchEvent::Add, path, initial);
+        }
+        path.resize(len);
+    }
+    closedir(d);
+    return slot;
+}
+
+void FSWatcher::report(WatchEvent ev, const string &path, bool initial) {
+    if (initial) {
+        emit(ev, path);
+        return;
+    }
+    clock::time_point now = clock::now();
+    auto it = _pending.find(path);
+    if (it == _pending.end()) {
+        _pending.emplace(path, Pending{ev, _seq++, now, now});
+        return;
+    }
+    Pending &p = it->second;
+    p.last = now;
+    bool wasGone = p.ev == WatchEvent::Unlink || p.ev == WatchEvent::UnlinkDir;
+    if (ev == WatchEvent::Change && p.ev == WatchEvent::Add) return;
+    if (ev == WatchEvent::Add && wasGone) ev = WatchEvent::Change;
+    p.ev = ev;
+}
+
+void FSWatcher::handle(const inotify_event *ev, string &buf) {
+    if (ev->mask & IN_Q_OVERFLOW) {
+        // events were lost, walk everything again and let the listeners treat it as new
+        emit(WatchEvent::Error, "inotify queue overflow");
+        for (size_t i = 0; i < _dirs.size(); i++) {
+            if (_dirs[i].parent != ROOT) continue;
+            pathOf(i, buf);
+            string root = buf;
+            watchDir(buf, ROOT, root, false, true);
+        }
+        return;
+    }
+    auto it = _slots.find(ev->wd);
+    if (it == _slots.end()) return;
+    int slot = it->second;
+    if (ev->mask & IN_IGNORED) {
+        unlink(slot);
+        // subdirectories still watched are usually gone already, the others can't be named without this one
+        for (int c = _dirs[slot].child; c >= 0;) {
+            int next = _dirs[c].next;
+            dropSubtree(c);
+            _dirs[c].parent = DETACHED;
+            _dirs[c].next = _dirs[c].prev = NO_DIR;
+            c = next;
+        }
+        Dir &d = _dirs[slot];
+        d.wd = -1;
+        d.parent = FREE;
+        d.child = NO_DIR;
+        string().swap(d.name);
+        _slots.erase(it);
+        _free.push_back(slot);
+        // the slot may be taken again before the moves are settled
+        erase_if(_moves, [slot](const auto &m) { return m.second == slot; });
+        return;
+    }
+    if (ev->mask & IN_DELETE_SELF || ev->len == 0) return;
+
+    string_view name(ev->name);
+    if (!pathOf(slot, buf)) return;
+    buf += '/';
+    buf += name;
+    bool isDir = ev->mask & IN_ISDIR;
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+        if (isDir) {
+            if (ev->mask & IN_MOVED_TO) _moves.erase(ev->cookie);
+            watchDir(buf, slot, name, false, true);
+        } else {
+            report(WatchEvent::Add, buf, false);
+        }
+    } else if (ev->mask & (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB)) {
+        if (!isDir) report(WatchEvent::Change, buf, false);
+    } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        report(isDir ? WatchEvent::UnlinkDir : WatchEvent::Unlink, buf, false);
+        if (isDir && (ev->mask & IN_MOVED_FROM)) {
+            int child = childOf(slot, name);
+            if (child >= 0) _moves[ev->cookie] = child;
+        }
+    }
+}
+
+int FSWatcher::flush(bool all) {
+    clock::time_point now = clock::now();
+    clock::duration quiet = chrono::milliseconds(_opts.coalesceMs);
+    vector<pair<uint64_t, decltype(_pending)::iterator>> due;
+    clock::time_point next = clock::time_point::max();
+    for (auto it = _pending.begin(); it != _pending.end(); it++) {
+        clock::time_point at = min(it->second.last + quiet, it->second.first + quiet * 10);
+        if (all || at <= now) due.emplace_back(it->second.seq, it);
+        else next = min(next, at);
+    }
+    sort(due.begin(), due.end(), [](auto &a, auto &b) { return a.first < b.first; });
+    for (auto &[seq, it] : due) {
+        emit(it->second.ev, it->first);
+        _pending.erase(it);
+    }
+    if (next == clock::time_point::max()) return -1;
+    return chrono::ceil<chrono::milliseconds>(next - now).count();
+}
+
+void FSWatcher::loop() {
+    alignas(inotify_event) char ibuf[64 * 1024];
+    epoll_event evs[2];
+    string path;
+    int timeout = -1;
+    for (;;) {
+        int n = epoll_wait(_epfd, evs, 2, timeout);
+        if (n < 0 && errno != EINTR) break;
+        bool stop = false;
+        lock_guard<mutex> lock(_mtx);
+        for (int i = 0; i < n; i++) {
+            if (evs[i].data.fd == _efd) {
+                stop = true;
+                continue;
+            }
+            ssize_t len;
+            while ((len = read(_ifd, ibuf, sizeof(ibuf))) > 0) {
+                for (char *p = ibuf; p < ibuf + len;) {
+                    inotify_event *ev = (inotify_event *)p;
+                    handle(ev, path);
+                    p += sizeof(inotify_event) + ev->len;
+                }
+            }
+            // directories moved out of the tree never get a matching IN_MOVED_TO
+            for (auto &[cookie, slot] : _moves) {
+                dropSubtree(slot);
+            }
+            _moves.clear();
+        }
+        timeout = flush(stop);
+        if (stop) break;
+    }
+}
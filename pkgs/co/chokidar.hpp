@@ -1 +1,101 @@
-#pragma once
\ No newline at end of file
+#pragma once
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+
+struct inotify_event;
+class StatPoller;
+
+enum class WatchEvent { Add, AddDir, Change, Unlink, UnlinkDir, Error };
+
+class ChokidarOpts {
+public:
+    bool ignoreInitial = false;
+    bool followSymlinks = true;
+    // Quiet period in which repeated events for one path are merged into one
+    int coalesceMs = 10;
+    // Return false to neither watch nor descend into a directory
+    std::function<bool(std::string_view)> *dirFilter = nullptr;
+    // Poll every root instead of using inotify, or only the roots on filesystems where inotify misses changes
+    bool usePolling = false;
+    bool autoPolling = true;
+    // Polling interval of a directory right after it changed, quiet ones back off up to maxIntervalMs
+    int intervalMs = 100;
+    int maxIntervalMs = 2000;
+};
+
+/*
+ * Recursive inotify watcher. Listeners run on the watcher thread (and on the caller of add() for the initial scan)
+ * while the watcher lock is held, so they must not call back into the watcher.
+ * Roots on NFS, FUSE, overlay and the like are handed to a StatPoller instead (decided per root with statfs).
+ */
+class FSWatcher {
+public:
+    explicit FSWatcher(std::optional<ChokidarOpts> opts = std::nullopt);
+    ~FSWatcher();
+    FSWatcher(const FSWatcher &) = delete;
+    FSWatcher &operator=(const FSWatcher &) = delete;
+
+    void on(std::function<void(WatchEvent, std::string_view)> listener);
+    void add(const std::string &dir);
+    void close();
+    size_t watched() const;
+
+private:
+    using clock = std::chrono::steady_clock;
+    // A watched directory in a slot of `_dirs`. The kernel never hands out a watch descriptor twice, so `_slots` maps
+    // them to slots that are reused once their watch is gone. Only the name is stored, full paths are rebuilt from
+    // the parent chain so memory grows with the number of directories and not with their depth. The subdirectories
+    // of a directory are a list of slots through `next`/`prev` starting at its `child`.
+    struct Dir {
+        int wd;
+        int32_t parent;
+        int32_t child;
+        int32_t next;
+        int32_t prev;
+        std::string name;
+    };
+    struct Pending {
+        WatchEvent ev;
+        uint64_t seq;
+        clock::time_point first;
+        clock::time_point last;
+    };
+
+    ChokidarOpts _opts;
+    int _ifd = -1;
+    int _efd = -1;
+    int _epfd = -1;
+    std::vector<Dir> _dirs;
+    std::unordered_map<int, int32_t> _slots;
+    std::vector<int32_t> _free;
+    std::unordered_map<std::string, Pending> _pending;
+    std::unordered_map<uint32_t, int> _moves;
+    uint64_t _seq = 0;
+    std::vector<std::function<void(WatchEvent, std::string_view)>> _listeners;
+    mutable std::mutex _mtx;
+    std::thread _thread;
+    bool _closed = false;
+    std::unique_ptr<StatPoller> _poller;
+
+    void loop();
+    int watchDir(std::string &path, int parent, std::string_view name, bool initial, bool rescan);
+    void setName(int slot, int parent, std::string_view name);
+    void link(int slot, int parent);
+    void unlink(int slot);
+    bool pathOf(int slot, std::string &out) const;
+    int childOf(int slot, std::string_view name) const;
+    void dropSubtree(int slot);
+    void handle(const inotify_event *ev, std::string &buf);
+    void report(WatchEvent ev, const std::string &path, bool initial);
+    int flush(bool all);
+    void emit(WatchEvent ev, std::string_view path);
+};
@@ -0,0 +1,638 @@
+#include <span>
+#include <array>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include "picomatch.hpp"
+
+/*
+ * Loosely based on https://github.com/micromatch/picomatch
+ * The original code was licensed under the MIT License -> https://github.com/micromatch/picomatch/blob/master/LICENSE
+ * Instead of translating the glob into a RegExp, the glob is brace-expanded at construction and every alternative is
+ * compiled into a list of path segments (literal, wildcard or globstar). Matching runs all alternatives side by side
+ * as a bitset NFA over the segments of the path, so it never allocates and never backtracks across segments.
+ * Supported: `*`, `?`, `**`, `[...]` classes (ranges, `!`/`^` negation, posix classes), `{a,b}` and `{1..3}` braces,
+ * backslash escapes and leading `!` negation. Extglobs (`@(a|b)` etc.) are not supported.
+ * PicomatchSet compiles many globs into the alternatives of one Picomatch, each tagged with the glob it came from.
+ */
+
+using namespace std;
+
+const size_t MAX_EXPANSIONS = 1 << 16;
+const size_t MAX_SEGMENTS = 63;
+const size_t MAX_RULES = 1 << 16;
+
+static bool isMagic(char c) {
+    return c == '*' || c == '?' || c == '[' || c == ']' || c == '{' || c == '}' || c == '(' || c == ')' || c == '!' || c == '+' || c == '@';
+}
+
+static size_t matchingBrace(const string &p, size_t open, vector<size_t> *commas) {
+    int depth = 0;
+    for (size_t j = open; j < p.size(); j++) {
+        if (p[j] == '\\') {
+            j++;
+            continue;
+        }
+        if (p[j] == '{') {
+            depth++;
+        } else if (p[j] == '}') {
+            if (--depth == 0) return j;
+        } else if (p[j] == ',' && depth == 1 && commas != nullptr) {
+            commas->push_back(j);
+        }
+    }
+    return string::npos;
+}
+
+static bool expandRange(string_view body, vector<string> &items) {
+    size_t dots = body.find("..");
+    if (dots == string::npos || dots == 0) return false;
+    string_view from = body.substr(0, dots);
+    string_view to = body.substr(dots + 2);
+    long step = 1;
+    size_t dots2 = to.find("..");
+    auto toLong = [](string_view s, long &out) {
+        if (s.empty()) return false;
+        size_t i = s[0] == '-' ? 1 : 0;
+        if (i == s.size()) return false;
+        long v = 0;
+        for (; i < s.size(); i++) {
+            if (s[i] < '0' || s[i] > '9') return false;
+            v = v * 10 + (s[i] - '0');
+        }
+        out = s[0] == '-' ? -v : v;
+        return true;
+    };
+    if (dots2 != string::npos) {
+        if (!toLong(to.substr(dots2 + 2), step)) return false;
+        if (step < 0) step = -step;
+        if (step == 0) step = 1;
+        to = to.substr(0, dots2);
+    }
+    long a, b;
+    if (toLong(from, a) && toLong(to, b)) {
+        size_t width = 0;
+        if ((from.size() > 1 && from[0] == '0') || (to.size() > 1 && to[0] == '0')) width = max(from.size(), to.size());
+        long dir = a <= b ? step : -step;
+        for (long v = a; a <= b ? v <= b : v >= b; v += dir) {
+            string s = to_string(v < 0 ? -v : v);
+            if (s.size() + (v < 0) < width) s.insert(0, width - s.size() - (v < 0), '0');
+            if (v < 0) s.insert(0, 1, '-');
+            items.push_back(s);
+            if (items.size() > MAX_EXPANSIONS) throw runtime_error("Brace expansion too large: {" + string(body) + "}");
+        }
+        return true;
+    }
+    if (from.size() == 1 && to.size() == 1) {
+        int x = (unsigned char)from[0], y = (unsigned char)to[0];
+        int dir = x <= y ? (int)step : -(int)step;
+        for (int v = x; x <= y ? v <= y : v >= y; v += dir) {
+            items.push_back(string(1, (char)v));
+        }
+        return true;
+    }
+    return false;
+}
+
+static void expandBraces(const string &p, vector<string> &out) {
+    for (size_t i = 0; i < p.size(); i++) {
+        if (p[i] == '\\') {
+            i++;
+            continue;
+        }
+        if (p[i] != '{') continue;
+        vector<size_t> commas;
+        size_t close = matchingBrace(p, i, &commas);
+        if (close == string::npos) break;
+        vector<string> items;
+        if (commas.empty()) {
+            if (!expandRange(string_view(p).substr(i + 1, close - i - 1), items)) continue;
+        } else {
+            size_t start = i + 1;
+            for (size_t c : commas) {
+                items.push_back(p.substr(start, c - start));
+                start = c + 1;
+            }
+            items.push_back(p.substr(start, close - start));
+        }
+        string pre = p.substr(0, i);
+        string post = p.substr(close + 1);
+        for (string &item : items) {
+            expandBraces(pre + item + post, out);
+            if (out.size() > MAX_EXPANSIONS) throw runtime_error("Brace expansion too large: " + p);
+        }
+        return;
+    }
+    out.push_back(p);
+}
+
+static string scanBase(string_view g) {
+    string base;
+    string seg;
+    size_t i = 0;
+    while (g.substr(i, 2) == "./") i += 2;
+    if (i < g.size() && g[i] == '/') {
+        base = "/";
+        i++;
+    }
+    for (; i < g.size(); i++) {
+        char c = g[i];
+        if (c == '/') {
+            if (!seg.empty()) {
+                if (!base.empty() && base.back() != '/') base += '/';
+                base += seg;
+            }
+            seg.clear();
+            continue;
+        }
+        if (c == '\\' && i + 1 < g.size()) {
+            seg += g[++i];
+            continue;
+        }
+        if (isMagic(c)) break;
+        seg += c;
+    }
+    // `seg` is now either the magic segment or the trailing file name, neither is part of the base
+    return base;
+}
+
+static array<uint64_t, 4> parseClass(string_view p, size_t &i, bool nocase, bool &ok) {
+    array<uint64_t, 4> bits{};
+    auto set = [&bits, nocase](unsigned char c) {
+        bits[c >> 6] |= 1ull << (c & 63);
+        if (nocase && isalpha(c)) {
+            unsigned char o = islower(c) ? toupper(c) : tolower(c);
+            bits[o >> 6] |= 1ull << (o & 63);
+        }
+    };
+    size_t j = i + 1;
+    bool neg = false;
+    if (j < p.size() && (p[j] == '!' || p[j] == '^')) {
+        neg = true;
+        j++;
+    }
+    size_t first = j;
+    ok = false;
+    for (; j < p.size(); j++) {
+        unsigned char c = p[j];
+        if (c == ']' && j > first) {
+            ok = true;
+            break;
+        }
+        if (c == '[' && j + 1 < p.size() && p[j + 1] == ':') {
+            size_t end = p.find(":]", j + 2);
+            if (end != string::npos) {
+                string_view name = p.substr(j + 2, end - j - 2);
+                int (*fn)(int) = nullptr;
+                if (name == "alpha") fn = isalpha;
+                else if (name == "digit") fn = isdigit;
+                else if (name == "alnum") fn = isalnum;
+                else if (name == "upper") fn = isupper;
+                else if (name == "lower") fn = islower;
+                else if (name == "space") fn = isspace;
+                else if (name == "punct") fn = ispunct;
+                else if (name == "xdigit") fn = isxdigit;
+                if (fn != nullptr) {
+                    for (int k = 0; k < 128; k++) {
+                        if (fn(k)) set(k);
+                    }
+                    j = end + 1;
+                    continue;
+                }
+            }
+        }
+        if (c == '\\' && j + 1 < p.size()) c = p[++j];
+        if (j + 2 < p.size() && p[j + 1] == '-' && p[j + 2] != ']') {
+            unsigned char hi = p[j + 2];
+            j += 2;
+            if (hi == '\\' && j + 1 < p.size()) hi = p[++j];
+            for (unsigned k = c; k <= hi; k++) set(k);
+            continue;
+        }
+        set(c);
+    }
+    if (!ok) return bits;
+    i = j;
+    // path separators are never matched by a class
+    bits['/' >> 6] &= ~(1ull << ('/' & 63));
+    if (neg) {
+        for (uint64_t &b : bits) b = ~b;
+        bits['/' >> 6] &= ~(1ull << ('/' & 63));
+    }
+    return bits;
+}
+
+Picomatch::Picomatch(string_view glob, optional<PicomatchOpts> opts) {
+    _opts = opts.value_or(PicomatchOpts());
+    if (!_opts.nonegate) {
+        while (!glob.empty() && glob[0] == '!' && glob.substr(0, 2) != "!(") {
+            _negated = !_negated;
+            glob.remove_prefix(1);
+        }
+    }
+    _base = scanBase(glob);
+    add(glob, 0);
+}
+
+void Picomatch::add(string_view glob, uint16_t rule) {
+    vector<string> patterns;
+    if (_opts.nobrace) patterns.push_back(string(glob));
+    else expandBraces(string(glob), patterns);
+    for (string &p : patterns) {
+        compile(p, rule);
+    }
+}
+
+void Picomatch::compile(string_view p, uint16_t rule) {
+    while (p.substr(0, 2) == "./") p.remove_prefix(2);
+    Alt alt{};
+    alt.rule = rule;
+    alt.seg = _segs.size();
+    alt.abs = !p.empty() && p[0] == '/';
+    size_t start = 0;
+    for (size_t i = 0; i <= p.size(); i++) {
+        if (i < p.size() && p[i] == '\\') {
+            i++;
+            continue;
+        }
+        if (i < p.size() && p[i] == '[') {
+            size_t end = i;
+            bool ok;
+            parseClass(p, end, false, ok);
+            if (ok) i = end;
+            continue;
+        }
+        if (i < p.size() && p[i] != '/') continue;
+        string_view seg = p.substr(start, i - start);
+        start = i + 1;
+        if (seg.empty()) continue;
+        if (seg == "**") {
+            if (_segs.size() > alt.seg && _segs.back().kind == SGlobstar) continue;
+            _segs.push_back(Seg{0, 0, SGlobstar, false});
+            continue;
+        }
+        compileSeg(seg);
+    }
+    alt.nseg = _segs.size() - alt.seg;
+    if (alt.nseg > MAX_SEGMENTS) throw runtime_error("Glob has too many segments: " + string(p));
+    for (uint16_t k = 0; k < alt.nseg; k++) {
+        if (_segs[alt.seg + k].kind == SGlobstar) alt.star |= 1ull << k;
+    }
+
+    // a literal tail that every match has to end with, checked before running the NFA
+    alt.suffix = _lits.size();
+    if (alt.nseg > 0) {
+        const Seg &last = _segs[alt.seg + alt.nseg - 1];
+        if (last.kind == SLiteral) {
+            string lit = _lits.substr(last.off, last.len);
+            _lits += lit;
+        } else if (last.kind == SWild) {
+            size_t k = last.len;
+            while (k > 0 && _toks[last.off + k - 1].kind == TChar) k--;
+            for (; k < last.len; k++) {
+                _lits += (char)_toks[last.off + k].ch;
+            }
+        }
+    }
+    alt.nsuffix = _lits.size() - alt.suffix;
+    _alts.push_back(alt);
+}
+
+void Picomatch::compileSeg(string_view seg) {
+    bool magic = false;
+    for (size_t i = 0; i < seg.size(); i++) {
+        if (seg[i] == '\\') {
+            i++;
+            continue;
+        }
+        if (seg[i] == '*' || seg[i] == '?') magic = true;
+        if (seg[i] == '[') {
+            size_t end = i;
+            bool ok;
+            parseClass(seg, end, false, ok);
+            if (ok) magic = true;
+        }
+    }
+    auto fold = [this](unsigned char c) {
+        return (uint8_t)(_opts.nocase ? tolower(c) : c);
+    };
+    if (!magic) {
+        Seg s{(uint32_t)_lits.size(), 0, SLiteral, false};
+        for (size_t i = 0; i < seg.size(); i++) {
+            if (seg[i] == '\\' && i + 1 < seg.size()) i++;
+            _lits += (char)fold(seg[i]);
+        }
+        s.len = _lits.size() - s.off;
+        _segs.push_back(s);
+        return;
+    }
+    Seg s{(uint32_t)_toks.size(), 0, SWild, false};
+    for (size_t i = 0; i < seg.size(); i++) {
+        char c = seg[i];
+        if (c == '*') {
+            if (_toks.size() > s.off && _toks.back().kind == TStar) continue;
+            _toks.push_back(Tok{TStar, 0, 0});
+        } else if (c == '?') {
+            _toks.push_back(Tok{TAny, 0, 0});
+        } else if (c == '[') {
+            size_t end = i;
+            bool ok;
+            array<uint64_t, 4> bits = parseClass(seg, end, _opts.nocase, ok);
+            if (ok) {
+                _toks.push_back(Tok{TClass, 0, (uint16_t)_classes.size()});
+                _classes.push_back(bits);
+                i = end;
+            } else {
+                _toks.push_back(Tok{TChar, (uint8_t)'[', 0});
+            }
+        } else {
+            if (c == '\\' && i + 1 < seg.size()) c = seg[++i];
+            _toks.push_back(Tok{TChar, fold(c), 0});
+        }
+    }
+    s.len = _toks.size() - s.off;
+    s.dot = _toks[s.off].kind == TChar && _toks[s.off].ch == '.';
+    _segs.push_back(s);
+}
+
+bool Picomatch::segMatch(const Seg &seg, string_view s) const {
+    if (seg.kind == SLiteral) {
+        if (seg.len != s.size()) return false;
+        const char *lit = _lits.data() + seg.off;
+        if (!_opts.nocase) return s.compare(0, s.size(), lit, seg.len) == 0;
+        for (size_t i = 0; i < s.size(); i++) {
+            if (tolower((unsigned char)s[i]) != (unsigned char)lit[i]) return false;
+        }
+        return true;
+    }
+    const Tok *toks = _toks.data() + seg.off;
+    size_t n = seg.len;
+    size_t p = 0, i = 0;
+    size_t starP = string::npos, starI = 0;
+    while (i < s.size()) {
+        if (p < n && toks[p].kind != TStar) {
+            unsigned char c = s[i];
+            bool ok;
+            switch (toks[p].kind) {
+                case TChar: ok = (_opts.nocase ? tolower(c) : c) == toks[p].ch; break;
+                case TClass: ok = (_classes[toks[p].cls][c >> 6] >> (c & 63)) & 1; break;
+                default: ok = true; break;
+            }
+            if (ok) {
+                p++;
+                i++;
+                continue;
+            }
+        } else if (p < n) {
+            starP = p++;
+            starI = i;
+            continue;
+        }
+        if (starP == string::npos) return false;
+        p = starP + 1;
+        i = ++starI;
+    }
+    while (p < n && toks[p].kind == TStar) p++;
+    return p == n;
+}
+
+static uint64_t closure(uint64_t m, uint64_t star) {
+    // a globstar may also match zero segments
+    for (;;) {
+        uint64_t add = ((m & star) << 1) & ~m;
+        if (add == 0) return m;
+        m |= add;
+    }
+}
+
+uint64_t Picomatch::step(const Alt &alt, uint64_t m, string_view s) const {
+    bool dotSeg = s[0] == '.';
+    bool special = s == "." || s == "..";
+    bool dotOk = !dotSeg || (_opts.dot && !special);
+    uint64_t live = m & ((1ull << alt.nseg) - 1);
+    uint64_t next = dotOk ? live & alt.star : 0;
+    uint64_t rest = live & ~alt.star;
+    while (rest != 0) {
+        int b = __builtin_ctzll(rest);
+        rest &= rest - 1;
+        const Seg &seg = _segs[alt.seg + b];
+        if (seg.kind == SWild && !dotOk && !seg.dot) continue;
+        if (segMatch(seg, s)) next |= 1ull << (b + 1);
+    }
+    return closure(next, alt.star);
+}
+
+// NFA states of `n` alternatives, on the stack of the caller when there are few of them
+static uint64_t *states(size_t n, uint64_t *local, size_t nlocal) {
+    if (n <= nlocal) return local;
+    thread_local vector<uint64_t> big;
+    if (big.size() < n) big.resize(n);
+    return big.data();
+}
+
+// Runs every alternative over the segments of `path`, leaves their states in `st` and returns whether any is alive
+template<bool Below> bool Picomatch::run(string_view path, uint64_t *st) const {
+    while (path.substr(0, 2) == "./") path.remove_prefix(2);
+    bool abs = !path.empty() && path[0] == '/';
+    size_t n = _alts.size();
+    bool any = false;
+    for (size_t a = 0; a < n; a++) {
+        const Alt &alt = _alts[a];
+        st[a] = 0;
+        if (alt.abs != abs) continue;
+        if (!Below && alt.nsuffix > 0) {
+            if (path.size() < alt.nsuffix) continue;
+            string_view tail = path.substr(path.size() - alt.nsuffix);
+            const char *suf = _lits.data() + alt.suffix;
+            bool ok = true;
+            for (size_t k = 0; k < tail.size() && ok; k++) {
+                unsigned char c = tail[k];
+                ok = (_opts.nocase ? tolower(c) : c) == (unsigned char)suf[k];
+            }
+            if (!ok) continue;
+        }
+        st[a] = closure(1, alt.star);
+        any = true;
+    }
+
+    size_t i = 0;
+    while (any && i < path.size()) {
+        size_t j = path.find('/', i);
+        if (j == string::npos) j = path.size();
+        if (j > i) {
+            string_view seg = path.substr(i, j - i);
+            any = false;
+            for (size_t a = 0; a < n; a++) {
+                if (st[a] == 0) continue;
+                st[a] = step(_alts[a], st[a], seg);
+                any = any || st[a] != 0;
+            }
+        }
+        i = j + 1;
+    }
+    return any;
+}
+
+template<bool Below> bool Picomatch::scan(string_view path) const {
+    size_t n = _alts.size();
+    uint64_t local[16];
+    uint64_t *st = states(n, local, 16);
+    if (!run<Below>(path, st)) return false;
+    for (size_t a = 0; a < n; a++) {
+        uint64_t accept = 1ull << _alts[a].nseg;
+        if (Below ? (st[a] & (accept - 1)) != 0 : (st[a] & accept) != 0) return true;
+    }
+    return false;
+}
+
+bool Picomatch::match(string_view path) const {
+    return scan<false>(path) != _negated;
+}
+
+size_t Picomatch::matchMany(span<const string_view> paths, vector<uint32_t> &hits) const {
+    size_t count = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (scan<false>(paths[i]) == _negated) continue;
+        hits.push_back(i);
+        count++;
+    }
+    return count;
+}
+
+bool Picomatch::couldMatchBelow(string_view dir) const {
+    if (_negated) return true;
+    return scan<true>(dir);
+}
+
+// Deepest common directory of two glob bases
+static string commonBase(const string &a, const string &b) {
+    size_t n = 0;
+    for (size_t i = 0;; i++) {
+        bool endA = i == a.size() || a[i] == '/';
+        bool endB = i == b.size() || b[i] == '/';
+        if (endA && endB) n = i;
+        if (i == a.size() || i == b.size() || a[i] != b[i]) break;
+    }
+    if (n == 0 && !a.empty() && a[0] == '/' && !b.empty() && b[0] == '/') return "/";
+    return a.substr(0, n);
+}
+
+PicomatchSet::PicomatchSet(span<const string> globs, optional<PicomatchOpts> opts) {
+    _m._opts = opts.value_or(PicomatchOpts());
+    bool first = true;
+    for (const string &g : globs) {
+        string_view glob = g;
+        bool negated = false;
+        if (!_m._opts.nonegate) {
+            while (!glob.empty() && glob[0] == '!' && glob.substr(0, 2) != "!(") {
+                negated = !negated;
+                glob.remove_prefix(1);
+            }
+        }
+        add(glob, negated ? RExclude : RInclude);
+        if (negated) continue;
+        string base = scanBase(glob);
+        _base = first ? base : commonBase(_base, base);
+        first = false;
+    }
+}
+
+void PicomatchSet::add(string_view glob, RuleKind kind) {
+    if (_rules.size() >= MAX_RULES) throw runtime_error("Too many globs");
+    _m.add(glob, _rules.size());
+    _rules.push_back(kind);
+}
+
+void PicomatchSet::addIgnore(string_view text, string_view dir) {
+    while (dir.substr(0, 2) == "./") dir.remove_prefix(2);
+    while (!text.empty()) {
+        size_t eol = text.find('\n');
+        string_view line = text.substr(0, eol);
+        text.remove_prefix(eol == string_view::npos ? text.size() : eol + 1);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        while (!line.empty() && line.back() == ' ' && (line.size() < 2 || line[line.size() - 2] != '\\')) {
+            line.remove_suffix(1);
+        }
+        if (line.empty() || line[0] == '#') continue;
+        bool negated = line[0] == '!';
+        if (negated) line.remove_prefix(1);
+        else if (line.substr(0, 2) == "\\#" || line.substr(0, 2) == "\\!") line.remove_prefix(1);
+        // a trailing slash only matches directories, a slash anywhere else anchors the pattern to `dir`
+        bool dirOnly = !line.empty() && line.back() == '/';
+        if (dirOnly) line.remove_suffix(1);
+        bool anchored = line.find('/') != string_view::npos;
+        if (!line.empty() && line[0] == '/') line.remove_prefix(1);
+        if (line.empty()) continue;
+        string glob = string(dir) + (anchored ? "" : "**/") + string(line);
+        RuleKind kind = negated ? RUnignore : RIgnore;
+        // files below an ignored directory are ignored too, which is also what lets the walk skip it
+        if (!dirOnly) add(glob, kind);
+        add(glob + "/**", kind);
+    }
+}
+
+bool PicomatchSet::match(string_view path) const {
+    size_t n = _m._alts.size();
+    uint64_t local[32];
+    uint64_t *st = states(n, local, 32);
+    if (!_m.run<false>(path, st)) return false;
+    bool included = false;
+    bool excluded = false;
+    size_t ignore = 0;
+    for (size_t a = 0; a < n; a++) {
+        const Picomatch::Alt &alt = _m._alts[a];
+        if ((st[a] & 1ull << alt.nseg) == 0) continue;
+        RuleKind kind = _rules[alt.rule];
+        if (kind == RInclude) included = true;
+        else if (kind == RExclude) excluded = true;
+        else ignore = max<size_t>(ignore, alt.rule + 1);
+    }
+    if (!included || excluded || ignore == 0) return included && !excluded;
+    if (_rules[ignore - 1] == RIgnore) return false;
+    // a line unignoring the path has no effect when a directory above it is ignored
+    for (size_t slash = path.find('/', 1); slash != string_view::npos; slash = path.find('/', slash + 1)) {
+        if (ignoredDir(path.substr(0, slash))) return false;
+    }
+    return true;
+}
+
+// Whether the last ignore file line covering everything below `dir` ignores it
+bool PicomatchSet::ignoredDir(string_view dir) const {
+    size_t n = _m._alts.size();
+    uint64_t local[32];
+    uint64_t *st = states(n, local, 32);
+    if (!_m.run<true>(dir, st)) return false;
+    size_t ignore = 0;
+    for (size_t a = 0; a < n; a++) {
+        const Picomatch::Alt &alt = _m._alts[a];
+        bool all = alt.nseg > 0 && (st[a] & alt.star & (1ull << alt.nseg) >> 1) != 0;
+        if (all && (_rules[alt.rule] == RIgnore || _rules[alt.rule] == RUnignore)) ignore = max<size_t>(ignore, alt.rule + 1);
+    }
+    return ignore != 0 && _rules[ignore - 1] == RIgnore;
+}
+
+bool PicomatchSet::couldMatchBelow(string_view dir) const {
+    size_t n = _m._alts.size();
+    uint64_t local[32];
+    uint64_t *st = states(n, local, 32);
+    if (!_m.run<true>(dir, st)) return false;
+    bool live = false;
+    // rule + 1 of the last ignore file line matching `dir` itself, which decides for everything below as in git
+    size_t ignore = 0;
+    for (size_t a = 0; a < n; a++) {
+        const Picomatch::Alt &alt = _m._alts[a];
+        uint64_t accept = 1ull << alt.nseg;
+        // a trailing globstar that is reached matches every path below
+        bool all = alt.nseg > 0 && (st[a] & alt.star & accept >> 1) != 0;
+        switch (_rules[alt.rule]) {
+            case RInclude: live = live || (st[a] & (accept - 1)) != 0; break;
+            case RExclude: if (all) return false; break;
+            default: if (all) ignore = max<size_t>(ignore, alt.rule + 1); break;
+        }
+    }
+    return live && (ignore == 0 || _rules[ignore - 1] != RIgnore);
+}
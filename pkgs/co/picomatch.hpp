@@ -0,0 +1,105 @@
+#pragma once
+#include <span>
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+class PicomatchOpts {
+public:
+    bool dot = false;
+    bool nocase = false;
+    bool nobrace = false;
+    bool nonegate = false;
+};
+
+class Picomatch {
+public:
+    Picomatch() = default;
+    explicit Picomatch(std::string_view glob, std::optional<PicomatchOpts> opts = std::nullopt);
+
+    bool match(std::string_view path) const;
+    // Appends the indices of the matching paths to `hits`, returns how many matched
+    size_t matchMany(std::span<const std::string_view> paths, std::vector<uint32_t> &hits) const;
+    // Whether anything below the directory `dir` could still match (used to prune walks)
+    bool couldMatchBelow(std::string_view dir) const;
+    // Leading literal directory of the glob, like picomatch.scan().base
+    const std::string &base() const { return _base; }
+    bool negated() const { return _negated; }
+
+private:
+    enum TokKind : uint8_t { TChar, TAny, TStar, TClass };
+    enum SegKind : uint8_t { SLiteral, SWild, SGlobstar };
+    struct Tok {
+        TokKind kind;
+        uint8_t ch;
+        uint16_t cls;
+    };
+    struct Seg {
+        uint32_t off;
+        uint16_t len;
+        SegKind kind;
+        bool dot;
+    };
+    struct Alt {
+        uint32_t seg;
+        uint16_t nseg;
+        bool abs;
+        uint64_t star;
+        uint32_t suffix;
+        uint16_t nsuffix;
+        // Index of the glob this alternative came from in a PicomatchSet
+        uint16_t rule;
+    };
+
+    std::vector<Tok> _toks;
+    std::vector<Seg> _segs;
+    std::vector<Alt> _alts;
+    std::vector<std::array<uint64_t, 4>> _classes;
+    std::string _lits;
+    std::string _base;
+    PicomatchOpts _opts;
+    bool _negated = false;
+
+    friend class PicomatchSet;
+
+    void add(std::string_view glob, uint16_t rule);
+    void compile(std::string_view pattern, uint16_t rule);
+    void compileSeg(std::string_view seg);
+    bool segMatch(const Seg &seg, std::string_view s) const;
+    uint64_t step(const Alt &alt, uint64_t m, std::string_view s) const;
+    template<bool Below> bool run(std::string_view path, uint64_t *st) const;
+    template<bool Below> bool scan(std::string_view path) const;
+};
+
+/*
+ * Several globs compiled into one matcher: a path matches when it matches one of the include globs, none of the `!`
+ * exclusions and is not ignored by the lines of a .gitignore style file (where the last matching line wins).
+ * The alternatives of every glob run side by side in a single pass over the path, and couldMatchBelow() prunes a
+ * directory as soon as no include can match below it, an exclusion ending in `**` covers it or it is ignored; like
+ * git, nothing below an ignored directory can be unignored.
+ */
+class PicomatchSet {
+public:
+    PicomatchSet() = default;
+    explicit PicomatchSet(std::span<const std::string> globs, std::optional<PicomatchOpts> opts = std::nullopt);
+
+    // Adds the lines of an ignore file, their patterns are relative to `dir` (empty or ending in a slash)
+    void addIgnore(std::string_view text, std::string_view dir = "");
+    bool match(std::string_view path) const;
+    bool couldMatchBelow(std::string_view dir) const;
+    // Deepest directory containing the base of every include glob
+    const std::string &base() const { return _base; }
+
+private:
+    enum RuleKind : uint8_t { RInclude, RExclude, RIgnore, RUnignore };
+
+    Picomatch _m;
+    std::vector<RuleKind> _rules;
+    std::string _base;
+
+    void add(std::string_view glob, RuleKind kind);
+    bool ignoredDir(std::string_view dir) const;
+};
@@ -0,0 +1,462 @@
+#include <mutex>
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <string_view>
+#include "poller.hpp"
+
+using namespace std;
+
+const int32_t FREE = -2;
+const int32_t ROOT = -1;
+// nameOff of a file whose name is still in the Sweep that found it
+const uint32_t LOCAL = 1u << 31;
+const unsigned STAT_MASK = STATX_TYPE | STATX_MODE | STATX_MTIME | STATX_CTIME | STATX_SIZE;
+
+// f_type of the filesystems whose changes inotify doesn't (reliably) see
+const unsigned long POLLED_FS[] = {
+    0x6969,     // nfs
+    0x517b,     // smb
+    0xff534d42, // cifs
+    0xfe534d42, // smb2
+    0x65735546, // fuse
+    0x794c7630, // overlay
+    0x01021997, // 9p
+    0x00c36400, // ceph
+};
+
+static int64_t nsOf(const statx_timestamp &t) {
+    return t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+bool needsPolling(const string &path) {
+    struct statfs fs;
+    if (statfs(path.c_str(), &fs) != 0) return false;
+    return find(begin(POLLED_FS), end(POLLED_FS), (unsigned long)fs.f_type) != end(POLLED_FS);
+}
+
+StatPoller::StatPoller(PollOpts opts, function<void(WatchEvent, string_view)> emit) : _opts(opts), _emit(emit) {}
+
+StatPoller::~StatPoller() {
+    close();
+}
+
+void StatPoller::add(const string &dir) {
+    string path = dir;
+    while (path.size() > 1 && path.back() == '/') path.pop_back();
+    {
+        lock_guard<mutex> lock(_mtx);
+        if (_closed) return;
+        if (access(path.c_str(), F_OK) != 0) throw runtime_error("Cannot watch " + dir + ": " + strerror(errno));
+        if (_opts.dirFilter != nullptr && !(*_opts.dirFilter)(path)) return;
+        scan(newDir(ROOT, path), path, true);
+    }
+    if (_thread.joinable()) return;
+    unsigned n = _opts.threads > 0 ? _opts.threads : max(1u, thread::hardware_concurrency());
+    for (unsigned i = 1; i < n; i++) {
+        _helpers.emplace_back(&StatPoller::help, this);
+    }
+    _thread = thread(&StatPoller::loop, this);
+}
+
+void StatPoller::close() {
+    {
+        lock_guard<mutex> lock(_mtx);
+        if (_closed) return;
+        _closed = true;
+    }
+    _wake.notify_all();
+    if (_thread.joinable()) _thread.join();
+    {
+        lock_guard<mutex> lock(_poolMtx);
+        _stopping = true;
+    }
+    _poolWork.notify_all();
+    for (thread &t : _helpers) {
+        t.join();
+    }
+}
+
+size_t StatPoller::watched() const {
+    lock_guard<mutex> lock(_mtx);
+    return _live;
+}
+
+void StatPoller::pathOf(int32_t dir, string &out) const {
+    thread_local vector<int32_t> chain;
+    chain.clear();
+    for (int32_t d = dir; d >= 0; d = _dirs[d].parent) {
+        chain.push_back(d);
+    }
+    out.clear();
+    for (size_t i = chain.size(); i-- > 0;) {
+        const Dir &d = _dirs[chain[i]];
+        if (!out.empty() && out.back() != '/') out += '/';
+        out.append(_names, d.nameOff, d.nameLen);
+    }
+}
+
+int32_t StatPoller::newDir(int32_t parent, string_view name) {
+    int32_t id;
+    if (!_free.empty()) {
+        id = _free.back();
+        _free.pop_back();
+    } else {
+        id = _dirs.size();
+        _dirs.emplace_back();
+    }
+    Dir &d = _dirs[id];
+    d.parent = parent;
+    d.nameOff = _names.size();
+    d.nameLen = name.size();
+    d.intervalMs = _opts.intervalMs;
+    d.mtime = d.ctime = 0;
+    d.next = clock::now() + chrono::milliseconds(d.intervalMs);
+    _names.append(name);
+    _live++;
+    return id;
+}
+
+// Takes the first snapshot of a directory and everything below it, `path` is its path
+void StatPoller::scan(int32_t id, string &path, bool initial) {
+    bool report = !initial || !_opts.ignoreInitial;
+    if (_dirs[id].parent != ROOT && report) _emit(WatchEvent::AddDir, path);
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | (_opts.followSymlinks ? 0 : O_NOFOLLOW));
+    if (fd < 0) return;
+    struct statx sx;
+    if (statx(fd, "", AT_EMPTY_PATH, STAT_MASK, &sx) == 0) {
+        _dirs[id].mtime = nsOf(sx.stx_mtime);
+        _dirs[id].ctime = nsOf(sx.stx_ctime);
+    }
+    DIR *d = fdopendir(fd);
+    if (d == nullptr) {
+        ::close(fd);
+        return;
+    }
+    int flags = _opts.followSymlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+    vector<File> files;
+    vector<string> dirs;
+    while (dirent *e = readdir(d)) {
+        if (e->d_name[0] == '.' && (e->d_name[1] == 0 || (e->d_name[1] == '.' && e->d_name[2] == 0))) continue;
+        if (statx(fd, e->d_name, flags, STAT_MASK, &sx) != 0) continue;
+        if (S_ISDIR(sx.stx_mode)) {
+            dirs.push_back(e->d_name);
+            continue;
+        }
+        uint32_t len = strlen(e->d_name);
+        files.push_back(File{(uint32_t)_names.size(), len, nsOf(sx.stx_mtime), nsOf(sx.stx_ctime), sx.stx_size});
+        _names.append(e->d_name, len);
+    }
+    closedir(d);
+    sort(files.begin(), files.end(), [this](const File &a, const File &b) {
+        return nameOf(a.nameOff, a.nameLen) < nameOf(b.nameOff, b.nameLen);
+    });
+    _dirs[id].files = move(files);
+
+    size_t len = path.size();
+    auto join = [&path, len](string_view name) {
+        path.resize(len);
+        if (path.back() != '/') path += '/';
+        path += name;
+    };
+    for (size_t i = 0; report && i < _dirs[id].files.size(); i++) {
+        join(nameOf(_dirs[id].files[i].nameOff, _dirs[id].files[i].nameLen));
+        _emit(WatchEvent::Add, path);
+    }
+    for (const string &name : dirs) {
+        join(name);
+        if (_opts.dirFilter != nullptr && !(*_opts.dirFilter)(path)) continue;
+        int32_t child = newDir(id, name);
+        _dirs[id].subdirs.push_back(child);
+        scan(child, path, initial);
+    }
+    path.resize(len);
+}
+
+// Reports a directory that is gone with everything below it, `path` is its path
+void StatPoller::drop(int32_t id, string &path) {
+    size_t len = path.size();
+    for (int32_t sub : _dirs[id].subdirs) {
+        path.resize(len);
+        path += '/';
+        path.append(nameOf(_dirs[sub].nameOff, _dirs[sub].nameLen));
+        drop(sub, path);
+    }
+    for (const File &f : _dirs[id].files) {
+        path.resize(len);
+        path += '/';
+        path.append(nameOf(f.nameOff, f.nameLen));
+        _emit(WatchEvent::Unlink, path);
+        _deadNames += f.nameLen;
+    }
+    path.resize(len);
+    _emit(WatchEvent::UnlinkDir, path);
+    Dir &d = _dirs[id];
+    _deadNames += d.nameLen;
+    d.parent = FREE;
+    vector<File>().swap(d.files);
+    vector<int32_t>().swap(d.subdirs);
+    // reused after the round, a sweep result may still refer to it
+    _dropped.push_back(id);
+    _live--;
+}
+
+// Runs on the pool, only reads the snapshot
+void StatPoller::sweep(int32_t id, Sweep &out) const {
+    const Dir &d = _dirs[id];
+    out.dir = id;
+    out.gone = out.listed = false;
+    out.mtime = out.ctime = 0;
+    out.files.clear();
+    out.names.clear();
+    out.events.clear();
+    out.newDirs.clear();
+    out.goneDirs.clear();
+    thread_local string path;
+    pathOf(id, path);
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | (_opts.followSymlinks ? 0 : O_NOFOLLOW));
+    if (fd < 0) {
+        out.gone = true;
+        return;
+    }
+    int flags = _opts.followSymlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+    struct statx sx;
+    if (statx(fd, "", AT_EMPTY_PATH, STAT_MASK, &sx) == 0) {
+        out.mtime = nsOf(sx.stx_mtime);
+        out.ctime = nsOf(sx.stx_ctime);
+    }
+    // entries added, removed or renamed move the directory's own times, otherwise only the files need a statx
+    bool list = out.mtime == 0 || out.mtime != d.mtime || out.ctime != d.ctime;
+    thread_local string name;
+    for (size_t i = 0; i < d.files.size() && !list; i++) {
+        const File &f = d.files[i];
+        name.assign(nameOf(f.nameOff, f.nameLen));
+        // replaced or removed within the timestamp granularity of the directory, a listing sorts that out
+        if (statx(fd, name.c_str(), flags, STAT_MASK, &sx) != 0 || S_ISDIR(sx.stx_mode)) {
+            list = true;
+            break;
+        }
+        File now{f.nameOff, f.nameLen, nsOf(sx.stx_mtime), nsOf(sx.stx_ctime), sx.stx_size};
+        if (now.mtime == f.mtime && now.ctime == f.ctime && now.size == f.size) continue;
+        if (out.files.empty()) out.files = d.files;
+        out.files[i] = now;
+        out.events.emplace_back(WatchEvent::Change, name);
+    }
+    if (!list) {
+        ::close(fd);
+        return;
+    }
+    out.files.clear();
+    out.events.clear();
+    out.listed = true;
+    DIR *dir = fdopendir(fd);
+    if (dir == nullptr) {
+        ::close(fd);
+        out.gone = true;
+        return;
+    }
+    thread_local vector<string> dirs;
+    dirs.clear();
+    while (dirent *e = readdir(dir)) {
+        if (e->d_name[0] == '.' && (e->d_name[1] == 0 || (e->d_name[1] == '.' && e->d_name[2] == 0))) continue;
+        if (statx(fd, e->d_name, flags, STAT_MASK, &sx) != 0) continue;
+        if (S_ISDIR(sx.stx_mode)) {
+            dirs.push_back(e->d_name);
+            continue;
+        }
+        uint32_t len = strlen(e->d_name);
+        out.files.push_back(File{LOCAL | (uint32_t)out.names.size(), len, nsOf(sx.stx_mtime), nsOf(sx.stx_ctime), sx.stx_size});
+        out.names.append(e->d_name, len);
+    }
+    closedir(dir);
+
+    auto nameOfAny = [this, &out](const File &f) {
+        if (f.nameOff & LOCAL) return string_view(out.names).substr(f.nameOff & ~LOCAL, f.nameLen);
+        return nameOf(f.nameOff, f.nameLen);
+    };
+    sort(out.files.begin(), out.files.end(), [&nameOfAny](const File &a, const File &b) {
+        return nameOfAny(a) < nameOfAny(b);
+    });
+    // both sides are sorted by name
+    size_t i = 0;
+    for (File &f : out.files) {
+        string_view n = nameOfAny(f);
+        for (; i < d.files.size() && nameOf(d.files[i].nameOff, d.files[i].nameLen) < n; i++) {
+            out.events.emplace_back(WatchEvent::Unlink, nameOf(d.files[i].nameOff, d.files[i].nameLen));
+        }
+        if (i == d.files.size() || nameOf(d.files[i].nameOff, d.files[i].nameLen) != n) {
+            out.events.emplace_back(WatchEvent::Add, n);
+            continue;
+        }
+        const File &old = d.files[i++];
+        if (old.mtime != f.mtime || old.ctime != f.ctime || old.size != f.size) out.events.emplace_back(WatchEvent::Change, n);
+        f.nameOff = old.nameOff;
+    }
+    for (; i < d.files.size(); i++) {
+        out.events.emplace_back(WatchEvent::Unlink, nameOf(d.files[i].nameOff, d.files[i].nameLen));
+    }
+
+    sort(dirs.begin(), dirs.end());
+    thread_local vector<string_view> known;
+    known.clear();
+    for (int32_t sub : d.subdirs) {
+        string_view n = nameOf(_dirs[sub].nameOff, _dirs[sub].nameLen);
+        known.push_back(n);
+        if (!binary_search(dirs.begin(), dirs.end(), n)) out.goneDirs.push_back(sub);
+    }
+    sort(known.begin(), known.end());
+    for (const string &n : dirs) {
+        if (!binary_search(known.begin(), known.end(), string_view(n))) out.newDirs.push_back(n);
+    }
+}
+
+void StatPoller::sweepDue() {
+    _nextSweep = 0;
+    // a few directories are not worth waking the pool for
+    bool wide = !_helpers.empty() && _due.size() >= 16;
+    if (wide) {
+        {
+            lock_guard<mutex> lock(_poolMtx);
+            _round++;
+            _busy = _helpers.size();
+        }
+        _poolWork.notify_all();
+    }
+    for (size_t i; (i = _nextSweep++) < _due.size();) {
+        sweep(_due[i], _sweeps[i]);
+    }
+    if (!wide) return;
+    unique_lock<mutex> lock(_poolMtx);
+    _poolDone.wait(lock, [this]() { return _busy == 0; });
+}
+
+void StatPoller::help() {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            unique_lock<mutex> lock(_poolMtx);
+            _poolWork.wait(lock, [this, seen]() { return _stopping || _round != seen; });
+            if (_stopping) return;
+            seen = _round;
+        }
+        for (size_t i; (i = _nextSweep++) < _due.size();) {
+            sweep(_due[i], _sweeps[i]);
+        }
+        lock_guard<mutex> lock(_poolMtx);
+        if (--_busy == 0) _poolDone.notify_all();
+    }
+}
+
+void StatPoller::apply(Sweep &s, string &path) {
+    int32_t id = s.dir;
+    // dropped along with its parent earlier in this round
+    if (_dirs[id].parent == FREE) return;
+    bool changed = !s.gone && (!s.events.empty() || !s.newDirs.empty() || !s.goneDirs.empty());
+    Dir &d = _dirs[id];
+    d.intervalMs = changed ? _opts.intervalMs : min<uint32_t>(d.intervalMs * 2, _opts.maxIntervalMs);
+    d.next = clock::now() + chrono::milliseconds(d.intervalMs);
+    // the listing of the parent reports a directory that is gone, a root is listed again once it is back
+    if (s.gone) {
+        d.mtime = d.ctime = 0;
+        return;
+    }
+    if (s.listed) {
+        d.mtime = s.mtime;
+        d.ctime = s.ctime;
+    }
+    if (s.listed || !s.files.empty()) {
+        for (File &f : s.files) {
+            if (!(f.nameOff & LOCAL)) continue;
+            string_view n = string_view(s.names).substr(f.nameOff & ~LOCAL, f.nameLen);
+            f.nameOff = _names.size();
+            _names.append(n);
+        }
+        d.files.swap(s.files);
+    }
+    if (!changed) return;
+
+    pathOf(id, path);
+    size_t len = path.size();
+    auto join = [&path, len](string_view name) {
+        path.resize(len);
+        if (path.back() != '/') path += '/';
+        path += name;
+    };
+    for (auto &[ev, name] : s.events) {
+        if (ev == WatchEvent::Unlink) _deadNames += name.size();
+        join(name);
+        _emit(ev, path);
+    }
+    for (int32_t sub : s.goneDirs) {
+        join(nameOf(_dirs[sub].nameOff, _dirs[sub].nameLen));
+        drop(sub, path);
+        vector<int32_t> &subs = _dirs[id].subdirs;
+        subs.erase(find(subs.begin(), subs.end(), sub));
+    }
+    for (const string &name : s.newDirs) {
+        join(name);
+        if (_opts.dirFilter != nullptr && !(*_opts.dirFilter)(path)) continue;
+        int32_t child = newDir(id, name);
+        _dirs[id].subdirs.push_back(child);
+        scan(child, path, false);
+    }
+}
+
+// Names of removed entries are left behind in _names, rewritten once they are the bigger part of it
+void StatPoller::compact() {
+    if (_names.size() < (1 << 20) || _deadNames * 2 < _names.size()) return;
+    string names;
+    names.reserve(_names.size() - _deadNames);
+    auto keep = [this, &names](uint32_t &off, uint32_t len) {
+        uint32_t to = names.size();
+        names.append(_names, off, len);
+        off = to;
+    };
+    for (Dir &d : _dirs) {
+        if (d.parent == FREE) continue;
+        keep(d.nameOff, d.nameLen);
+        for (File &f : d.files) {
+            keep(f.nameOff, f.nameLen);
+        }
+    }
+    _names.swap(names);
+    _deadNames = 0;
+}
+
+void StatPoller::loop() {
+    string path;
+    unique_lock<mutex> lock(_mtx);
+    while (!_closed) {
+        clock::time_point now = clock::now();
+        clock::time_point wake = now + chrono::milliseconds(_opts.maxIntervalMs);
+        _due.clear();
+        for (size_t i = 0; i < _dirs.size(); i++) {
+            if (_dirs[i].parent == FREE) continue;
+            if (_dirs[i].next <= now) _due.push_back(i);
+            else wake = min(wake, _dirs[i].next);
+        }
+        if (_due.empty()) {
+            _wake.wait_until(lock, wake);
+            continue;
+        }
+        if (_sweeps.size() < _due.size()) _sweeps.resize(_due.size());
+        sweepDue();
+        for (size_t i = 0; i < _due.size(); i++) {
+            apply(_sweeps[i], path);
+        }
+        _free.insert(_free.end(), _dropped.begin(), _dropped.end());
+        _dropped.clear();
+        compact();
+    }
+}
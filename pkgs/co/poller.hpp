@@ -0,0 +1,118 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <condition_variable>
+#include "chokidar.hpp"
+
+class PollOpts {
+public:
+    unsigned threads = 0;
+    bool followSymlinks = true;
+    bool ignoreInitial = false;
+    // A directory is polled `intervalMs` after it changed, every quiet sweep doubles that up to `maxIntervalMs`
+    int intervalMs = 100;
+    int maxIntervalMs = 2000;
+    std::function<bool(std::string_view)> *dirFilter = nullptr;
+};
+
+/*
+ * Watches trees by polling, for filesystems on which inotify misses changes (chokidar's usePolling). Every directory
+ * keeps a snapshot of its files (name, mtime, ctime and size) in flat arrays. A sweep statx()es the directories that
+ * are due on a thread pool, lists only those whose own mtime or ctime moved and compares their files against the
+ * snapshot, so a quiet tree costs one statx per entry and interval. `emit` runs on the poll thread (and on the caller
+ * of add() for the initial scan) while the poller lock is held, it must not call back into the poller.
+ */
+class StatPoller {
+public:
+    StatPoller(PollOpts opts, std::function<void(WatchEvent, std::string_view)> emit);
+    ~StatPoller();
+    StatPoller(const StatPoller &) = delete;
+    StatPoller &operator=(const StatPoller &) = delete;
+
+    void add(const std::string &dir);
+    void close();
+    size_t watched() const;
+
+private:
+    using clock = std::chrono::steady_clock;
+    struct File {
+        uint32_t nameOff;
+        uint32_t nameLen;
+        int64_t mtime;
+        int64_t ctime;
+        uint64_t size;
+    };
+    // Like the directories of FSWatcher only the name is stored, the files are sorted by name
+    struct Dir {
+        int32_t parent;
+        uint32_t nameOff;
+        uint32_t nameLen;
+        uint32_t intervalMs;
+        int64_t mtime;
+        int64_t ctime;
+        clock::time_point next;
+        std::vector<File> files;
+        std::vector<int32_t> subdirs;
+    };
+    // What a worker found in one directory, applied on the poll thread once the sweep is done
+    struct Sweep {
+        int32_t dir;
+        bool gone;
+        bool listed;
+        int64_t mtime;
+        int64_t ctime;
+        // The new snapshot if anything changed, names not known yet point into `names` (flagged with LOCAL)
+        std::vector<File> files;
+        std::string names;
+        std::vector<std::pair<WatchEvent, std::string>> events;
+        std::vector<std::string> newDirs;
+        std::vector<int32_t> goneDirs;
+    };
+
+    PollOpts _opts;
+    std::function<void(WatchEvent, std::string_view)> _emit;
+    std::vector<Dir> _dirs;
+    std::vector<int32_t> _free;
+    std::vector<int32_t> _dropped;
+    std::string _names;
+    size_t _deadNames = 0;
+    size_t _live = 0;
+    mutable std::mutex _mtx;
+    std::condition_variable _wake;
+    std::thread _thread;
+    bool _closed = false;
+
+    // the sweep pool, the poll thread takes part in every sweep
+    std::vector<int32_t> _due;
+    std::vector<Sweep> _sweeps;
+    std::atomic<size_t> _nextSweep{0};
+    std::vector<std::thread> _helpers;
+    std::mutex _poolMtx;
+    std::condition_variable _poolWork;
+    std::condition_variable _poolDone;
+    uint64_t _round = 0;
+    size_t _busy = 0;
+    bool _stopping = false;
+
+    std::string_view nameOf(uint32_t off, uint32_t len) const { return std::string_view(_names).substr(off, len); }
+    void pathOf(int32_t dir, std::string &out) const;
+    int32_t newDir(int32_t parent, std::string_view name);
+    void scan(int32_t dir, std::string &path, bool initial);
+    void drop(int32_t dir, std::string &path);
+    void sweep(int32_t dir, Sweep &out) const;
+    void sweepDue();
+    void apply(Sweep &s, std::string &path);
+    void compact();
+    void help();
+    void loop();
+};
+
+// Whether inotify misses changes below `path`: network, FUSE and overlay filesystems
+bool needsPolling(const std::string &path);
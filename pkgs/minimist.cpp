@@ -223,9 +223,9 @@ json minimist(vector<string> args, optional<MinimistOpts> _opts) {
             smatch m;
             regex_match(arg, m, regex("^--(.+)"));
             key = m[1];
-            if (args.size() < i + 1) next = args[i + 1];
+            if (i + 1 < args.size()) next = args[i + 1];
             else next = "";
-            if (next.size() > 0 && regex_search(next, regex("^(-|--)[^-]")) && !isBooleanKey(key) && !flags.allBools) {
+            if (next.size() > 0 && !regex_search(next, regex("^(-|--)[^-]")) && !isBooleanKey(key) && !flags.allBools) {
                 setArg(key, next, arg);
                 i++;
             } else if (regex_search(next, regex("^(true|false)$"))) {
@@ -1,9 +1,12 @@
 #pragma once
 #include <map>
 #include <string>
+#include <vector>
 #include <optional>
 #include <variant>
+#include <cstddef>
 #include <functional>
+#include <string_view>
 #include <type_traits>
 #include <nlohmann/json.hpp>
 
@@ -18,4 +21,148 @@ public:
     std::function<bool(std::string)> *unknown = nullptr;
 };
 
-nlohmann::json minimist(std::vector<std::string> args, std::optional<MinimistOpts> _opts);
\ No newline at end of file
+nlohmann::json minimist(std::vector<std::string> args, std::optional<MinimistOpts> _opts);
+
+/*
+ * Typed variant of minimist for a fixed set of options: a constexpr table of ArgSpec maps every option to a member of
+ * `T`, which also provides the defaults (its member initializers) and the positional arguments (`T::_`). Only boolean
+ * options (`flag`) and repeatable string options (`list`) exist, and the same rules as minimist decide which arguments
+ * are values, except that a string option without a value is ignored instead of set to "".
+ */
+template <class T>
+class ArgSpec {
+public:
+    std::string_view name;
+    std::string_view alias = "";
+    char letter = 0;
+    bool T::*flag = nullptr;
+    std::vector<std::string> T::*list = nullptr;
+};
+
+template <class T, size_t N>
+constexpr bool validArgs(const ArgSpec<T> (&specs)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        if (specs[i].name.empty() || (specs[i].flag == nullptr) == (specs[i].list == nullptr)) return false;
+        for (size_t j = 0; j < i; j++) {
+            if (specs[i].name == specs[j].name || (specs[i].letter != 0 && specs[i].letter == specs[j].letter)) return false;
+            if (!specs[i].alias.empty() && (specs[i].alias == specs[j].alias || specs[i].alias == specs[j].name)) return false;
+        }
+    }
+    return true;
+}
+
+namespace argparse {
+// -x or --x followed by anything but a dash, such an argument is never taken as the value of the option before it
+constexpr bool looksLikeFlag(std::string_view s) {
+    return s.size() > 1 && s[0] == '-' && (s[1] != '-' || (s.size() > 2 && s[2] != '-'));
+}
+
+constexpr bool isAlpha(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+constexpr bool isWord(char c) {
+    return isAlpha(c) || (c >= '0' && c <= '9') || c == '_';
+}
+
+// what minimist's unanchored /-?\d+(\.\d*)?(e-?\d+)?$/ accepts: something that ends like a number
+constexpr bool endsInNumber(std::string_view s) {
+    auto digit = [](char c) { return c >= '0' && c <= '9'; };
+    if (s.empty()) return false;
+    return digit(s.back()) || (s.back() == '.' && s.size() > 1 && digit(s[s.size() - 2]));
+}
+}
+
+template <class T, size_t N>
+T parseArgs(const ArgSpec<T> (&specs)[N], int argc, const char *const *argv, std::vector<std::string_view> &unknown) {
+    using namespace argparse;
+    T out;
+    auto find = [&specs](std::string_view key) -> const ArgSpec<T> * {
+        for (const ArgSpec<T> &s : specs) {
+            if (s.name == key || (!s.alias.empty() && s.alias == key) || (key.size() == 1 && s.letter == key[0])) return &s;
+        }
+        return nullptr;
+    };
+    auto setValue = [&out](const ArgSpec<T> *s, std::string_view value) {
+        if (s->flag != nullptr) out.*(s->flag) = value != "false";
+        else (out.*(s->list)).emplace_back(value);
+    };
+    auto setFlag = [&out](const ArgSpec<T> *s, bool value) {
+        if (s->flag != nullptr) out.*(s->flag) = value;
+        else if (!value) (out.*(s->list)).clear();
+    };
+    auto isBool = [](const ArgSpec<T> *s) { return s->flag != nullptr; };
+
+    int end = 1;
+    while (end < argc && std::string_view(argv[end]) != "--") end++;
+    for (int i = 1; i < end; i++) {
+        std::string_view arg = argv[i];
+        std::string_view next = i + 1 < end ? argv[i + 1] : "";
+        size_t eq = arg.find('=', 3);
+        if (arg.size() > 2 && arg.substr(0, 2) == "--" && eq != std::string_view::npos) {
+            const ArgSpec<T> *s = find(arg.substr(2, eq - 2));
+            if (s == nullptr) unknown.push_back(arg);
+            else setValue(s, arg.substr(eq + 1));
+        } else if (arg.size() > 5 && arg.substr(0, 5) == "--no-") {
+            const ArgSpec<T> *s = find(arg.substr(5));
+            if (s == nullptr) unknown.push_back(arg);
+            else setFlag(s, false);
+        } else if (arg.size() > 2 && arg.substr(0, 2) == "--") {
+            const ArgSpec<T> *s = find(arg.substr(2));
+            if (s == nullptr) {
+                unknown.push_back(arg);
+            } else if (!next.empty() && !looksLikeFlag(next) && !isBool(s)) {
+                setValue(s, next);
+                i++;
+            } else if (next == "true" || next == "false") {
+                setFlag(s, next == "true");
+                i++;
+            } else {
+                setFlag(s, true);
+            }
+        } else if (arg.size() > 1 && arg[0] == '-' && arg[1] != '-') {
+            // -abc sets a and b, c may take the next argument, a value can also be glued on as in -c=x or -n5
+            bool broken = false;
+            for (size_t j = 1; j + 1 < arg.size(); j++) {
+                const ArgSpec<T> *s = find(arg.substr(j, 1));
+                std::string_view rest = arg.substr(j + 1);
+                std::string_view value = rest;
+                bool glued = false;
+                if (rest == "-") {
+                } else if (isAlpha(arg[j]) && rest[0] == '=') {
+                    value = rest.substr(1);
+                    glued = true;
+                } else if ((isAlpha(arg[j]) && endsInNumber(rest)) || (j + 2 < arg.size() && !isWord(rest[0]))) {
+                    glued = true;
+                }
+                if (s == nullptr) unknown.push_back(arg);
+                else if (glued || rest == "-") setValue(s, value);
+                else setFlag(s, true);
+                if (glued) {
+                    broken = true;
+                    break;
+                }
+            }
+            std::string_view key = arg.substr(arg.size() - 1);
+            if (broken || key == "-") continue;
+            const ArgSpec<T> *s = find(key);
+            if (s == nullptr) {
+                unknown.push_back(arg);
+            } else if (!next.empty() && !looksLikeFlag(next) && !isBool(s)) {
+                setValue(s, next);
+                i++;
+            } else if (next == "true" || next == "false") {
+                setFlag(s, next == "true");
+                i++;
+            } else {
+                setFlag(s, true);
+            }
+        } else {
+            out._.emplace_back(arg);
+        }
+    }
+    for (int i = end + 1; i < argc; i++) {
+        out._.emplace_back(argv[i]);
+    }
+    return out;
+}
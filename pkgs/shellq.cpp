@@ -1,133 +1,177 @@
 #include <regex>
-#include <cmath>
 #include <vector>
 #include <string>
-#include <random>
-#include <sstream>
+#include <cstdint>
+#include <utility>
 #include <variant>
-#include <iomanip>
-#include <iostream>
 #include <optional>
-#include <exception>
+#include <algorithm>
+#include <stdexcept>
 #include <functional>
+#include <string_view>
 #include <nlohmann/json.hpp>
 #include "shellq.hpp"
 
 /*
  * Copy of https://github.com/ljharb/shell-quote/
  * The original code was licensed under the MIT License -> https://github.com/ljharb/shell-quote/blob/main/LICENSE
- * This code is *almost* fully functional, the only error i could find is the incorrect parsing of escaped single quotes (which should not be common)
- * eg. When this is the input -> "a \"b c\" \\$def 'it\\'s great'"
- * The output is this -> ["a","b c","$def","it\\s great"]
- * When the expected output is this -> ["a", "b c", "$def", "it's great"]
+ * Unlike the original, input is tokenized by a hand-written scanner instead of the chunker regex, and escaped single
+ * quotes inside single quotes are unescaped, eg. "a \"b c\" \\$def 'it\\'s great'" -> ["a", "b c", "$def", "it's great"]
+ * Tokens are returned as a flat ShqResult, parseShq converts them to the json shell-quote would return.
  */
 
 using namespace std;
 using json = nlohmann::json;
 
 // constants
-const string CONTROL = "(?:\\|\\||\\&\\&|;;|\\|\\&|\\<\\(|\\<\\<\\<|>>|>\\&|<\\&|[&;()|<>])";
-const regex controlRE("^" + CONTROL + "$");
-const string META = "|&;()<> \\t";
-const string SINGLE_QUOTE = "\"((\\\\\"|[^\"])*?)\"";
-const string DOUBLE_QUOTE = "\'((\\\\\'|[^\'])*?)\'";
-const regex hashRE("^#$");
-const string SQ = "'";
-const string DQ = "\"";
-const string DS = "$";
-string TOKEN;
-regex startsWithToken;
+// multi character operators, in the order the original CONTROL alternation tries them
+const string_view CONTROL_OPS[] = {"||", "&&", ";;", "|&", "<(", "<<<", ">>", ">&", "<&"};
+const char SQ = '\'';
+const char DQ = '"';
+const char DS = '$';
 
-void initToken() {
-    stringstream tokenStrm;
-    unsigned long long mult = pow(16, 8);
-    random_device randDev;
-    mt19937_64 rng(randDev());
-    uniform_int_distribution<unsigned long long> rDist(0, mult);
-    tokenStrm << hex;
-    for (int i = 0; i < 4; i++) {
-        tokenStrm << rDist(rng);
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+static bool isMeta(char c) {
+    return c == '|' || c == '&' || c == ';' || c == '(' || c == ')' || c == '<' || c == '>';
+}
+
+static bool isVarChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Length of the control operator at `pos`, or 0
+static size_t controlAt(string_view s, size_t pos) {
+    for (string_view op : CONTROL_OPS) {
+        if (s.compare(pos, op.size(), op) == 0) return op.size();
     }
-    TOKEN = tokenStrm.str();
-    startsWithToken = regex("^" + TOKEN);
+    return isMeta(s[pos]) ? 1 : 0;
 }
-pair<vector<vector<string>>, vector<int>> matchAll(string s, regex r, int lastIndex) {
-    vector<smatch> matches;
-    smatch c;
-    int gP = lastIndex;
-    vector<int> mIdx;
-    string::const_iterator it(s.cbegin() + lastIndex);
-    while (regex_search(it, s.cend(), c, r)) {
-        matches.push_back(c);
-        lastIndex = c.position() + c.length();
-        if (lastIndex == c.position()) {
-            lastIndex++;
-        }
-        mIdx.push_back(gP + c.position());
-        it += lastIndex;
-        gP += lastIndex;
-        c = smatch();
+
+/*
+ * End of the quoted string opening at `pos`, or npos. Like the lazy "((\\"|[^"])*?)" it replaces, an escaped quote
+ * does not close the string, unless no other quote follows, then the last escaped one does.
+ */
+static size_t quoteEnd(string_view s, size_t pos) {
+    char q = s[pos];
+    size_t lastEscaped = string_view::npos;
+    for (size_t k = pos + 1; k < s.size(); k++) {
+        if (s[k] == q) return k + 1;
+        if (s[k] == '\\' && k + 1 < s.size() && s[k + 1] == q) lastEscaped = ++k;
     }
-    vector<vector<string>> sm2s;
-    for (smatch &m : matches) {
-        vector<string> sv;
-        for (auto &ms : m) {
-            sv.push_back(ms);
+    return lastEscaped == string_view::npos ? lastEscaped : lastEscaped + 1;
+}
+
+// Length of the word (barewords and quoted strings without whitespace in between) at `pos`, or 0
+static size_t wordAt(string_view s, size_t pos, char bs) {
+    size_t k = pos;
+    while (k < s.size()) {
+        char c = s[k];
+        if (c == SQ || c == DQ) {
+            size_t end = quoteEnd(s, k);
+            if (end == string_view::npos) break;
+            k = end;
+        } else if (c == bs && k + 1 < s.size() && (s[k + 1] == SQ || s[k + 1] == DQ || s[k + 1] == ' '
+                                                    || s[k + 1] == '\t' || isMeta(s[k + 1]))) {
+            k += 2;
+        } else if (!isSpace(c) && !isMeta(c)) {
+            k++;
+        } else {
+            break;
         }
-        sm2s.push_back(sv);
     }
-    return pair<vector<vector<string>>, vector<int>>(sm2s, mIdx);
+    return k - pos;
 }
 
-string getVar(env_t *env, string pre, string key) {
+ShqResult parseShqTokens(string_view str, env_t *env, optional<json> opts) {
+    const char BS = opts.has_value() && opts->contains("escape") ? (*opts)["escape"].get_ref<const string &>()[0] : '\\';
+    env_t e = json();
+    if (env == nullptr) env = &e;
     function<string(string)> *sf = get_if<function<string(string)>>(env);
     function<json(string)> *jf = get_if<function<json(string)>>(env);
     json *j = get_if<json>(env);
-    optional<string> sr;
-    optional<json> jr;
-    if (sf != nullptr) sr = (*sf)(key);
-    else if (jf != nullptr) jr = (*jf)(key);
-    else if (j != nullptr && j->contains(key)) sr = (*j)[key];
-    string r;
-    bool noV = !sr.has_value() && !jr.has_value();
-    if (noV && key.size() < 1) {
-        r = "";
-    } else if (noV) {
-        r = "$";
-    }
-    if (sr.has_value()) r = sr.value();
-    else if (jr.has_value()) {
-        return pre + TOKEN + jr.value().dump() + TOKEN;
-    }
-    return pre + r;
-}
-variant<json, vector<smatch>> parseInternal(string str, env_t *env, optional<json> _opts) {
-    json opts = _opts.value_or(json({}));
-    const string BS = opts.contains("escape") ? opts["escape"] : "\\";
-    const string BAREWORD = "(\\" + BS + "['\"" + META + "]|[^\\s'\"" + META + "])+";
-    regex chunker("(" + CONTROL + ")|(" + BAREWORD + "|" + SINGLE_QUOTE + "|" + DOUBLE_QUOTE + ")+");
 
-    pair<vector<vector<string>>, vector<int>> matches = matchAll(str, chunker, 0);
-    if (matches.first.size() < 1) return vector<smatch>();
-
-    if (env == nullptr) {
-        env_t e = json();
-        env = &e;
-    }
+    ShqResult res;
+    string &arena = res.arena;
+    // objects met in the current word, as (arena offset, index in res.objects)
+    vector<pair<size_t, uint32_t>> splits;
+    auto push = [&res](ShqKind kind, size_t off, size_t len, bool joined) {
+        res.tokens.push_back(ShqToken{kind, joined, (uint32_t)off, (uint32_t)len});
+    };
+    auto appendVar = [&](string_view key) {
+        if (sf != nullptr) {
+            arena += (*sf)(string(key));
+        } else if (jf != nullptr) {
+            splits.emplace_back(arena.size(), res.objects.size());
+            res.objects.push_back((*jf)(string(key)));
+        } else if (j != nullptr && j->contains(key)) {
+            arena += (*j)[string(key)].get_ref<const string &>();
+        } else if (key.size() > 0) {
+            arena += DS;
+        }
+    };
+    // ends the word that started at `wordOff`, objects split it into several joined tokens
+    auto pushWord = [&](size_t wordOff, bool isGlob) {
+        if (splits.empty()) {
+            push(isGlob ? ShqKind::Glob : ShqKind::Word, wordOff, arena.size() - wordOff, false);
+            return;
+        }
+        if (isGlob) {
+            // a pattern stays one token, objects in it are inlined as json
+            string pattern;
+            size_t from = wordOff;
+            for (auto &[at, idx] : splits) {
+                pattern.append(arena, from, at - from);
+                pattern += res.objects[idx].dump();
+                from = at;
+            }
+            pattern.append(arena, from);
+            arena.resize(wordOff);
+            arena += pattern;
+            push(ShqKind::Glob, wordOff, pattern.size(), false);
+        } else {
+            bool joined = false;
+            size_t from = wordOff;
+            for (auto &[at, idx] : splits) {
+                if (at > from) {
+                    push(ShqKind::Word, from, at - from, joined);
+                    joined = true;
+                }
+                push(ShqKind::Object, idx, 0, joined);
+                joined = true;
+                from = at;
+            }
+            if (arena.size() > from) push(ShqKind::Word, from, arena.size() - from, joined);
+        }
+        splits.clear();
+    };
 
     bool commented = false;
-    json r = json::array();
-    int idx = 0;
-    for (vector<string> &match : matches.first) {
-        if (match.size() < 1) continue;
-        string s = match[0];
-        if (s.size() < 1 || commented) continue;
-        json jOp;
-        jOp["op"] = s;
-
+    for (size_t pos = 0; pos < str.size() && !commented;) {
+        // find the next chunk, anything that is neither an operator nor a word (whitespace, unterminated quotes) is
+        // skipped
+        size_t len = controlAt(str, pos);
+        bool control = len > 0;
+        if (!control) len = wordAt(str, pos, BS);
+        if (len == 0) {
+            pos++;
+            continue;
+        }
+        string_view s = str.substr(pos, len);
+        size_t start = pos;
+        pos += len;
+        size_t wordOff = arena.size();
+        if (control) {
+            arena += s;
+            push(ShqKind::Op, wordOff, len, false);
+            continue;
+        }
         // Hand-written scanner/parser for Bash quoting rules:
 		//
-		// 1. inside single quotes, all characters are printed literally.
+		// 1. inside single quotes, all characters are printed literally,
+		//    except escaped single quotes
 		// 2. inside double quotes, all characters are printed literally
 		//    except variables prefixed by '$' and backslashes followed by
 		//    either a double quote or another backslash.
@@ -136,175 +180,124 @@ variant<json, vector<smatch>> parseInternal(string str, env_t *env, optional<jso
 		// 4. quote context can switch mid-token if there is no whitespace
 		//     between the two quote contexts (e.g. all'one'"token" parses as
 		//     "allonetoken")
-        string quote = "";
+        char quote = 0;
         bool esc = false;
-        stringstream out;
         bool isGlob = false;
         size_t i = 0;
-        auto parseEnvVar = [&i, &s, &env]() {
+        // s[i] past the end reads as '\0', like indexing the std::string the chunks used to be
+        auto at = [&s](size_t k) { return k < s.size() ? s[k] : '\0'; };
+        auto parseEnvVar = [&i, &s, &at, &appendVar]() {
             i++;
-            size_t varend;
-            string varname;
-            char ch = s[i];
+            string_view varname;
+            char ch = at(i);
             if (ch == '{') {
                 i++;
-                if (s[i] == '}') {
-                    throw runtime_error("Bad substitution: " + string(s.begin() + i - 2, s.begin() + i + 1));
+                if (at(i) == '}') {
+                    throw runtime_error("Bad substitution: " + string(s.substr(i - 2, 3)));
                 }
-                varend = s.find_first_of('}', i);
-                if (varend == string::npos) {
-                    throw runtime_error("Bad substitution: " + string(s.begin() + i, s.end()));
+                size_t varend = s.find('}', i);
+                if (varend == string_view::npos) {
+                    throw runtime_error("Bad substitution: " + string(s.substr(min(i, s.size()))));
                 }
-                varname = string(s.begin() + i, s.begin() + varend);
+                varname = s.substr(i, varend - i);
                 i = varend;
-            } else if (regex_search(string(1, ch), regex("[*@#?$!_-]"))) {
-                varname = ch;
+            } else if (ch != 0 && string_view("*@#?$!_-").find(ch) != string_view::npos) {
+                varname = s.substr(i, 1);
                 i++;
             } else {
-                string slicedFromI(s.begin() + i, s.end() - 1);
-                smatch m;
-                if (!regex_match(slicedFromI, m, regex("[^\\w\\d_]"))) {
-                    varname = slicedFromI;
-                    i = s.size();
-                } else {
-                    varname = string(slicedFromI.begin(), slicedFromI.begin() + m.position() - 1);
-                    i += m.position() - 1;
-                }
+                size_t end = i;
+                while (end < s.size() && isVarChar(s[end])) end++;
+                varname = s.substr(min(i, s.size()), end - min(i, s.size()));
+                if (end == s.size()) i = s.size();
+                else i = end - 1;
             }
-            return getVar(env, "", varname);
+            appendVar(varname);
         };
 
-        if (regex_search(s, controlRE)) {
-            r.push_back(jOp);
-            goto cont;
-        }
-
         for (i = 0; i < s.size(); i++) {
             char c = s[i];
-            isGlob = isGlob || (quote.size() < 1 && (c == '*' || c == '?'));
-            string cs(1, c);
+            isGlob = isGlob || (quote == 0 && (c == '*' || c == '?'));
             if (esc) {
-                out << c;
+                arena += c;
                 esc = false;
-            } else if (quote.size() > 0) {
-                if (string(1, c) == quote) {
-                    quote = "";
+            } else if (quote != 0) {
+                if (c == quote) {
+                    quote = 0;
                 } else if (quote == SQ) {
-                    out << c;
+                    if (c == BS && at(i + 1) == SQ) c = s[++i];
+                    arena += c;
+                } else if (c == BS) {
+                    c = at(++i);
+                    if (c != DQ && c != BS && c != DS) arena += BS;
+                    arena += c;
+                } else if (c == DS) {
+                    parseEnvVar();
                 } else {
-                    cs = string(1, c);
-                    if (cs == BS) {
-                        i++;
-                        c = s[i];
-                        cs = string(1, c);
-                        if (cs == DQ || cs == BS || cs == DS) {
-                            out << c;
-                        } else {
-                            out << BS << c;
-                        }
-                    } else if (cs == DS) {
-                        out << parseEnvVar();
-                    } else {
-                        out << c;
-                    }
+                    arena += c;
                 }
-            } else if (cs == DQ || cs == SQ) {
+            } else if (c == DQ || c == SQ) {
                 quote = c;
-            } else if (regex_search(cs, controlRE)) {
-                r.push_back(jOp);
+            } else if (isMeta(c)) {
+                // only reachable when an escaped quote fooled the chunking, the whole chunk becomes the operator
+                splits.clear();
+                arena.resize(wordOff);
+                arena += s;
+                push(ShqKind::Op, wordOff, len, false);
                 goto cont;
-            } else if (regex_search(cs, hashRE)) {
+            } else if (c == '#') {
                 commented = true;
-                json cO;
-                cO["comment"] = string(str.begin() + matches.second[idx] + i + 1, str.end());
-                if (out.str().size() > 0) {
-                    json jA = json::array();
-                    jA.push_back(out.str());
-                    jA.push_back(cO);
-                    r.push_back(jA);
-                    goto cont;
-                } else {
-                    json jA = json::array();
-                    jA.push_back(cO);
-                    r.push_back(jA);
-                    goto cont;
-                }
-            } else if (cs == BS) {
+                bool joined = arena.size() > wordOff || !splits.empty();
+                if (joined) pushWord(wordOff, false);
+                size_t commentOff = arena.size();
+                arena += str.substr(start + i + 1);
+                push(ShqKind::Comment, commentOff, arena.size() - commentOff, joined);
+                goto cont;
+            } else if (c == BS) {
                 esc = true;
-            } else if (cs == DS) {
-                out << parseEnvVar();
+            } else if (c == DS) {
+                parseEnvVar();
             } else {
-                out << c;
+                arena += c;
             }
         }
-        
-        if (isGlob) {
-            json jG;
-            jG["op"] = "glob";
-            jG["pattern"] = out.str();
-            r.push_back(jG);
-            goto cont;
-        }
-        
-        r.push_back(out.str());
 
+        pushWord(wordOff, isGlob);
         cont:;
-        idx++;
     }
-    return r;
+    return res;
 }
 
-variant<json, vector<smatch>> parseShq(string s, env_t *env = nullptr, optional<json> opts = nullopt) {
-    if (TOKEN.size() < 1) initToken();
-    variant<json, vector<smatch>> mapped = parseInternal(s, env, opts);
-    json *jA = get_if<json>(&mapped);
-    vector<smatch> *sA = get_if<vector<smatch>>(&mapped);
-    if (sA != nullptr) return *sA;
-    auto split = [](string s, string delim) {
-        vector<string> v;
-        size_t pos;
-        string tok;
-        while ((pos = s.find(delim)) != string::npos) {
-            tok = s.substr(0, pos);
-            v.push_back(tok);
-            s.erase(0, pos + delim.size());
-        }
-        v.push_back(s);
-        return v;
-    };
-    auto splitRe = [](string s, string delim) {
-        vector<string> v;
-        size_t pos;
-        string tok;
-        smatch m;
-        while (regex_search(s, m, regex(delim))) {
-            pos = m.position();
-            tok = s.substr(0, pos);
-            v.push_back(tok);
-            s.erase(0, pos + m.length());
-        }
-        v.push_back(s);
-        return v;
-    };
-    json jR = json::array();
-    for (json &r : *jA) {
-        if (!r.is_string()) {
-            jR.push_back(r);
-            continue;
-        }
-        vector<string> xs = splitRe(r, "(" + TOKEN + ".*?" + TOKEN + ")");
-        if (xs.size() == 1) {
-            jR.push_back(xs[0]);
-        } else {
-            for (string &x : xs) {
-                if (x.size() < 1) continue;
-                if (regex_search(x, regex(startsWithToken))) {
-                    jR.push_back(json::parse(split(x, TOKEN)[1]));
-                } else {
-                    jR.push_back(x);
+variant<json, vector<smatch>> parseShq(string s, env_t *env, optional<json> opts) {
+    ShqResult res = parseShqTokens(s, env, opts);
+    if (res.tokens.empty()) return vector<smatch>();
+    json r = json::array();
+    for (const ShqToken &t : res.tokens) {
+        switch (t.kind) {
+            case ShqKind::Word:
+                r.push_back(res.text(t));
+                break;
+            case ShqKind::Op:
+                r.push_back(json{{"op", res.text(t)}});
+                break;
+            case ShqKind::Glob:
+                r.push_back(json{{"op", "glob"}, {"pattern", res.text(t)}});
+                break;
+            case ShqKind::Object:
+                r.push_back(res.objects[t.off]);
+                break;
+            case ShqKind::Comment: {
+                // shell-quote returns a comment together with the word it is glued to
+                json jA = json::array();
+                if (t.joined) {
+                    jA.push_back(r.back());
+                    r.erase(r.end() - 1);
                 }
+                jA.push_back(json{{"comment", res.text(t)}});
+                r.push_back(jA);
+                break;
             }
         }
     }
-    return jR;
+    return r;
 }
+
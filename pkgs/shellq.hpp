@@ -2,10 +2,38 @@
 #include <regex>
 #include <string>
 #include <vector>
+#include <cstdint>
 #include <variant>
+#include <optional>
 #include <functional>
+#include <string_view>
 #include <nlohmann/json.hpp>
 
-void initToken();
 typedef std::variant<nlohmann::json, std::function<std::string(std::string)>, std::function<nlohmann::json(std::string)>> env_t;
-std::variant<nlohmann::json, std::vector<std::smatch>> parseShq(std::string s, env_t *env, std::optional<nlohmann::json> opts);
\ No newline at end of file
+
+enum class ShqKind : uint8_t { Word, Op, Glob, Comment, Object };
+
+/*
+ * `off` and `len` select the token's text in ShqResult::arena, objects instead have their index in
+ * ShqResult::objects in `off`. A `joined` token follows the previous one without whitespace in between: the pieces of
+ * a word split by objects, or a comment that starts inside a word.
+ */
+struct ShqToken {
+    ShqKind kind;
+    bool joined;
+    uint32_t off;
+    uint32_t len;
+};
+
+class ShqResult {
+public:
+    std::vector<ShqToken> tokens;
+    std::string arena;
+    // values of variables looked up with a json returning env
+    std::vector<nlohmann::json> objects;
+
+    std::string_view text(const ShqToken &t) const { return std::string_view(arena).substr(t.off, t.len); }
+};
+
+ShqResult parseShqTokens(std::string_view s, env_t *env = nullptr, std::optional<nlohmann::json> opts = std::nullopt);
+std::variant<nlohmann::json, std::vector<std::smatch>> parseShq(std::string s, env_t *env, std::optional<nlohmann::json> opts);
@@ -0,0 +1,387 @@
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <algorithm>
+#include <sys/stat.h>
+#include <functional>
+#include "../lib/log.hpp"
+#include "../lib/cpx.hpp"
+#include "../lib/copy.hpp"
+#include "../lib/walk.hpp"
+#include "../lib/clean.hpp"
+#include "../lib/uring.hpp"
+#include "../lib/scheduler.hpp"
+#include "../pkgs/shellq.hpp"
+#include "../pkgs/co/picomatch.hpp"
+
+/*
+ * Regression tests for cpx, build and run with `make test` or ./cpx-test [filter]. Every case runs in a fresh
+ * directory under /tmp with its own cache directory for manifests, and the process exits non-zero if one fails.
+ */
+
+using namespace std;
+
+static size_t failures = 0;
+
+#define CHECK(cond)                                                                                                   \
+    do {                                                                                                              \
+        if (!(cond)) {                                                                                                \
+            fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);                                \
+            failures++;                                                                                               \
+        }                                                                                                             \
+    } while (0)
+
+static void writeFile(const string &path, const string &data) {
+    size_t slash = path.find_last_of('/');
+    if (slash != string::npos) mkdirs(path.substr(0, slash));
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, data.data(), data.size()) != (ssize_t)data.size()) perror(path.c_str());
+    close(fd);
+}
+
+static bool exists(const string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+static string readFile(const string &path) {
+    string data;
+    int fd = open(path.c_str(), O_RDONLY);
+    char buf[4096];
+    for (ssize_t n; fd >= 0 && (n = read(fd, buf, sizeof(buf))) > 0;) {
+        data.append(buf, n);
+    }
+    if (fd >= 0) close(fd);
+    return data;
+}
+
+// Waits up to a few seconds for `cond`
+static bool eventually(const function<bool()> &cond) {
+    for (int i = 0; i < 5000; i++) {
+        if (cond()) return true;
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return cond();
+}
+
+// Runs `fn` inside a new temporary directory, with XDG_CACHE_HOME pointing into it
+static void run(const string &filter, const string &name, const function<void()> &fn) {
+    if (name.find(filter) == string::npos) return;
+    char tmpl[] = "/tmp/cpx-test-XXXXXX";
+    string root = mkdtemp(tmpl);
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr) cwd[0] = 0;
+    if (chdir(root.c_str()) != 0) perror(root.c_str());
+    setenv("XDG_CACHE_HOME", (root + "/cache").c_str(), 1);
+    size_t before = failures;
+    try {
+        fn();
+    } catch (const exception &e) {
+        fprintf(stderr, "  threw: %s\n", e.what());
+        failures++;
+    }
+    logger.flush();
+    printf("%s %s\n", failures == before ? "ok  " : "FAIL", name.c_str());
+    if (chdir(cwd) != 0) perror(cwd);
+    if (system(("rm -rf '" + root + "'").c_str()) != 0) perror(root.c_str());
+}
+
+// -u -C twice: the second run removes the copies first and must make all of them again, unchanged sources included
+static void testUpdateClean() {
+    vector<string> files;
+    for (int d = 0; d < 8; d++) {
+        for (int f = 0; f < 16; f++) {
+            files.push_back("d" + to_string(d) + "/f" + to_string(f) + ".txt");
+            writeFile("src/" + files.back(), "content " + files.back());
+        }
+    }
+    CpxOpts opts;
+    opts.update = true;
+    opts.clean = true;
+    for (int pass = 0; pass < 2; pass++) {
+        CHECK(Cpx({"src/**"}, "dist", opts).copy() == 0);
+        size_t missing = 0;
+        for (const string &f : files) {
+            missing += !exists("dist/" + f);
+        }
+        CHECK(missing == 0);
+    }
+}
+
+// Braces are expanded up front, nested ones and ranges included, and every alternative runs in the same NFA pass
+static void testGlob() {
+    Picomatch braces("src/{a,b{1,2}}/*.{js,css}");
+    CHECK(braces.match("src/a/x.js"));
+    CHECK(braces.match("src/b2/x.css"));
+    CHECK(!braces.match("src/b/x.js"));
+    CHECK(!braces.match("src/a/x.html"));
+    CHECK(braces.base() == "src");
+    Picomatch range("f{1..3}.txt");
+    CHECK(range.match("f2.txt") && !range.match("f4.txt"));
+
+    Picomatch globstar("a/**/b/*.txt");
+    CHECK(globstar.match("a/b/x.txt"));
+    CHECK(globstar.match("a/x/y/b/z.txt"));
+    CHECK(!globstar.match("a/x/b/y/z.txt"));
+    CHECK(!globstar.match("a/.x/b/z.txt"));
+    CHECK(globstar.couldMatchBelow("a/x"));
+    CHECK(!globstar.couldMatchBelow("c"));
+
+    Picomatch classes("[a-c]?[!0-9].md");
+    CHECK(classes.match("bxy.md"));
+    CHECK(!classes.match("dxy.md"));
+    CHECK(!classes.match("bx1.md"));
+    PicomatchOpts opts;
+    opts.dot = true;
+    opts.nocase = true;
+    CHECK(Picomatch("**/*.MD", opts).match("docs/.hidden/READ.md"));
+    CHECK(!Picomatch("**/*.md").match("docs/.hidden/read.md"));
+
+    vector<string_view> paths{"src/a/x.js", "src/c/x.js", "src/b1/y.css"};
+    vector<uint32_t> hits;
+    CHECK(braces.matchMany(paths, hits) == 2);
+    CHECK((hits == vector<uint32_t>{0, 2}));
+}
+
+// One string per token: its kind, a '+' when it is joined to the one before and its text
+static vector<string> shqTokens(string_view line, env_t *env = nullptr) {
+    ShqResult res = parseShqTokens(line, env);
+    vector<string> out;
+    for (const ShqToken &t : res.tokens) {
+        string s(1, "wogcx"[(int)t.kind]);
+        if (t.joined) s += '+';
+        s += ':';
+        s += t.kind == ShqKind::Object ? res.objects[t.off].dump() : string(res.text(t));
+        out.push_back(s);
+    }
+    return out;
+}
+
+// The scanner follows bash quoting, keeps patterns and comments apart and splits words around json variables. Unset
+// variables stay "$", like before the scanner was rewritten
+static void testShellq() {
+    CHECK((shqTokens("a 'b c'\"d\"e f\\ g") == vector<string>{"w:a", "w:b cde", "w:f g"}));
+    CHECK((shqTokens("'it\\'s' \"\\\"q\\\\\\n\"") == vector<string>{"w:it's", "w:\"q\\\\n"}));
+    CHECK((shqTokens("gzip < in.txt | wc -c && echo ok; x") == vector<string>{"w:gzip", "o:<", "w:in.txt", "o:|", "w:wc", "w:-c", "o:&&", "w:echo", "w:ok", "o:;", "w:x"}));
+    CHECK((shqTokens("ls *.js 'a*' # all of them") == vector<string>{"w:ls", "g:*.js", "w:a*", "c: all of them"}));
+    CHECK((shqTokens("a#b") == vector<string>{"w:a", "c+:b"}));
+
+    env_t vars = nlohmann::json{{"IN", "src/a b"}};
+    CHECK((shqTokens("cat \"$IN\" ${IN}x $NONE", &vars) == vector<string>{"w:cat", "w:src/a b", "w:src/a bx", "w:$"}));
+    env_t objects = function<nlohmann::json(string)>([](string key) { return nlohmann::json{{"key", key}}; });
+    CHECK((shqTokens("pre$V.post", &objects) == vector<string>{"w:pre", "x+:{\"key\":\"V\"}", "w+:.post"}));
+    bool threw = false;
+    try {
+        parseShqTokens("echo ${}");
+    } catch (const runtime_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+// Like git, a negated ignore line brings back files but nothing below an ignored directory
+static void testIgnoreNegation() {
+    PicomatchSet set(vector<string>{"**"});
+    set.addIgnore("*.log\n!keep.log\nbuild/\n!build/keep.txt\n!build/sub/\n");
+    CHECK(set.match("a.txt"));
+    CHECK(!set.match("a.log"));
+    CHECK(set.match("keep.log"));
+    CHECK(set.match("d/keep.log"));
+    CHECK(!set.match("build/keep.txt"));
+    CHECK(!set.match("build/sub/a.txt"));
+    CHECK(!set.match("d/build/keep.txt"));
+    CHECK(!set.couldMatchBelow("build"));
+}
+
+// The cleaner removes what the glob matches with its siblings and then the directories that became empty, bottom-up.
+// A matching symlink goes itself, its target stays. Directories that were empty before, the ones keeping other files and
+// the root are left alone
+static void testCleaner() {
+    for (const char *f : {"a.js", "a.js.gz", "a.txt", "d/b.js", "d/e/c.js", "d/e/c.js.br", "x/y.js", "x/keep.txt", "t/t.js"}) {
+        writeFile(string("out/") + f, "x");
+    }
+    mkdirs("out/empty");
+    CHECK(symlink("../x", "out/d/link") == 0);
+    PicomatchSet glob(vector<string>{"src/**/*.js", "src/d/link"});
+    mutex mtx;
+    vector<string> removed;
+    function<void(string_view, bool)> onRemove = [&](string_view path, bool dir) {
+        lock_guard<mutex> lock(mtx);
+        removed.push_back(string(path) + (dir ? "/" : ""));
+    };
+    CleanOpts co;
+    co.threads = 2;
+    co.glob = &glob;
+    co.prefix = "src/";
+    co.siblings = {".gz", ".br"};
+    co.onRemove = &onRemove;
+
+    co.dryRun = true;
+    CHECK(Cleaner("out", co).wait() == 0);
+    sort(removed.begin(), removed.end());
+    CHECK((removed == vector<string>{"a.js", "a.js.gz", "d/b.js", "d/e/c.js", "d/e/c.js.br", "d/link", "t/t.js", "x/y.js"}));
+    CHECK(exists("out/d/e/c.js"));
+
+    removed.clear();
+    co.dryRun = false;
+    CHECK(Cleaner("out", co).wait() == 8);
+    CHECK(exists("out/a.txt") && exists("out/x/keep.txt") && exists("out/empty"));
+    CHECK(exists("out/x") && !exists("out/t/t.js"));
+    CHECK(!exists("out/d") && !exists("out/t") && !exists("out/a.js.gz"));
+    CHECK(find(removed.begin(), removed.end(), "d/e/") < find(removed.begin(), removed.end(), "d/"));
+
+    mkdirs("only");
+    writeFile("only/z.js", "z");
+    CHECK(Cleaner("only", co).wait() == 1);
+    CHECK(exists("only") && !exists("only/z.js"));
+}
+
+// A job submitted while one for the same destination runs cancels it, and of the jobs queued meanwhile only the
+// last one runs
+static void testSchedulerCoalesce() {
+    mutex mtx;
+    vector<string> ran;
+    atomic<bool> started{false};
+    atomic<bool> firstCancelled{false};
+    SchedulerOpts so;
+    so.threads = 2;
+    CopyScheduler scheduler([&](const CopyJob &job, const atomic<bool> &cancel) {
+        if (job.src == "1") {
+            started = true;
+            firstCancelled = eventually([&cancel]() { return cancel.load(); });
+        }
+        lock_guard<mutex> lock(mtx);
+        ran.push_back(job.src);
+    }, so);
+    scheduler.submit("x", CopyJob{JobKind::Copy, "1"});
+    CHECK(eventually([&started]() { return started.load(); }));
+    scheduler.submit("x", CopyJob{JobKind::Copy, "2"});
+    scheduler.submit("x", CopyJob{JobKind::Copy, "3"});
+    scheduler.submit("y", CopyJob{JobKind::Copy, "4"});
+    scheduler.close();
+    CHECK(firstCancelled);
+    sort(ran.begin(), ran.end());
+    CHECK((ran == vector<string>{"1", "3", "4"}));
+}
+
+// A cancelled copy leaves the destination as it was, so with -u the copy that replaces it still happens
+static void testCancelledCopy() {
+    writeFile("dst/a.bin", "old");
+    struct stat before;
+    stat("dst/a.bin", &before);
+    this_thread::sleep_for(chrono::milliseconds(10));
+    writeFile("src/a.bin", string(64 << 20, 'x'));
+    CopyEngine engine;
+    CopyOpts co;
+    co.update = true;
+    atomic<bool> cancel{false};
+    co.cancel = &cancel;
+    // cancels as soon as anything is written, be it to the destination or a temporary file next to it
+    thread canceller([&cancel, &before]() {
+        eventually([&before]() {
+            struct stat st;
+            if (stat("dst/a.bin", &st) == 0 && st.st_mtim.tv_nsec != before.st_mtim.tv_nsec) return true;
+            DIR *dir = opendir("dst");
+            bool temp = false;
+            for (dirent *e; dir != nullptr && (e = readdir(dir)) != nullptr;) {
+                temp = temp || string(e->d_name).find(".cpx-") != string::npos;
+            }
+            if (dir != nullptr) closedir(dir);
+            return temp;
+        });
+        cancel = true;
+    });
+    CopyStatus status = engine.copy("src/a.bin", "dst/a.bin", co);
+    canceller.join();
+    // done before the canceller saw it start, nothing left to check
+    if (status != CopyStatus::Cancelled) return;
+    CHECK(readFile("dst/a.bin") == "old");
+    cancel = false;
+    CHECK(engine.copy("src/a.bin", "dst/a.bin", co) == CopyStatus::Copied);
+    CHECK(readFile("dst/a.bin").size() == 64 << 20);
+}
+
+// -p keeps the setuid and setgid bits, the change of owner that clears them comes first
+static void testPreserveSetuid() {
+    writeFile("src/tool", "#!/bin/sh\n");
+    // needs root to give the file away
+    if (chown("src/tool", 1, 1) != 0) return;
+    chmod("src/tool", 06755);
+    CopyEngine engine;
+    CopyOpts co;
+    co.preserve = true;
+    CHECK(engine.copy("src/tool", "dst/tool", co) == CopyStatus::Copied);
+    struct stat st;
+    CHECK(stat("dst/tool", &st) == 0 && (st.st_mode & 07777) == 06755 && st.st_uid == 1);
+}
+
+// The walk leaves out FIFOs, whose open would block the copy for good
+static void testWalkSpecialFiles() {
+    writeFile("src/a.txt", "a");
+    writeFile("src/d/b.txt", "b");
+    CHECK(mkfifo("src/fifo", 0644) == 0);
+    CHECK(mkfifo("src/d/fifo", 0644) == 0);
+    PicomatchSet glob(vector<string>{"src/**"});
+    WalkOpts wo;
+    wo.glob = &glob;
+    mutex mtx;
+    vector<string> seen;
+    walk("src", wo, [&](const WalkEntry &e) {
+        lock_guard<mutex> lock(mtx);
+        seen.emplace_back(e.path);
+    });
+    sort(seen.begin(), seen.end());
+    CHECK((seen == vector<string>{"src/a.txt", "src/d/b.txt"}));
+    CHECK(Cpx({"src/**"}, "dist", CpxOpts()).copy() == 0);
+    CHECK(!exists("dist/fifo") && exists("dist/d/b.txt"));
+}
+
+// Files whose chain fails still give their slots back, the files after them in those slots are copied
+static void testUringFailures() {
+    UringCopier ring(2, 4096);
+    if (!ring.available()) return;
+    mkdirs("dst");
+    vector<UringJob> jobs;
+    for (int i = 0; i < 12; i++) {
+        string name = "f" + to_string(i);
+        writeFile("src/" + name, "data " + name);
+        // every third destination is in a directory that doesn't exist, its open fails
+        string dst = i % 3 == 0 ? "missing/" + name : "dst/" + name;
+        jobs.push_back(UringJob{"src/" + name, dst, (off_t)(5 + name.size()), 0644});
+    }
+    jobs.push_back(UringJob{"src/none", "dst/none", 4, 0644});
+    vector<int> errs(jobs.size(), -1);
+    for (int round = 0; round < 3; round++) {
+        ring.copy(jobs, [&](const UringJob &j, int err) { errs[&j - jobs.data()] = err; });
+        for (size_t i = 0; i + 1 < jobs.size(); i++) {
+            CHECK(errs[i] == (i % 3 == 0 ? ENOENT : 0));
+            if (i % 3 != 0) CHECK(readFile(jobs[i].dst) == "data f" + to_string(i));
+        }
+        CHECK(errs.back() == ENOENT);
+    }
+}
+
+int main(int argc, char **argv) {
+    string filter = argc > 1 ? argv[1] : "";
+    run(filter, "update clean", testUpdateClean);
+    run(filter, "glob", testGlob);
+    run(filter, "shellq", testShellq);
+    run(filter, "ignore negation", testIgnoreNegation);
+    run(filter, "cleaner", testCleaner);
+    run(filter, "scheduler coalesce", testSchedulerCoalesce);
+    run(filter, "cancelled copy", testCancelledCopy);
+    run(filter, "preserve setuid", testPreserveSetuid);
+    run(filter, "walk special files", testWalkSpecialFiles);
+    run(filter, "uring failures", testUringFailures);
+    logger.close();
+    if (failures > 0) fprintf(stderr, "%zu check(s) failed\n", failures);
+    return failures > 0 ? 1 : 0;
+}